@@ -0,0 +1,339 @@
+/**
+ *   PsychicMqttClient
+ *
+ *   Throughput and latency benchmark for the PsychicMqttClient library.
+ *
+ *   Please change the ssid and pass to your actual WiFi credentials and point
+ *   broker to a local MQTT broker. A public broker will mostly measure the internet.
+ *
+ *   The benchmark subscribes to its own topics and runs a matrix of scenarios:
+ *   QoS 0, 1 and 2, payloads from 16 bytes up to four times the buffer size to
+ *   exercise multipart reassembly, fan-in to N onTopic filters and sync vs. async
+ *   publishing. Every message is echoed back by the broker. For each scenario it
+ *   reports msgs/s, bytes/s, the latency percentiles from publish to PUBACK (or
+ *   PUBCOMP) and from publish to the echo, and the heap high-water mark.
+ *
+ *   Results are printed as one JSON object per line, prefixed with nothing else,
+ *   so the serial log can be fed into scripts/compare_benchmark.py to compare two
+ *   runs. On the Linux host build the process exits when the benchmark is done:
+ *
+ *   PSYCHIC_MQTT_BROKER=mqtt://localhost ./build-host/examples/Benchmark > results.jsonl
+ *
+ */
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <PsychicMqttClient.h>
+
+#include <algorithm>
+
+const char ssid[] = "ssid";                  // your network SSID (name)
+const char pass[] = "pass";                  // your network password
+const char broker[] = "mqtt://192.168.1.10"; // your local MQTT broker
+
+#define BENCH_BUFFER_SIZE 1024    // MQTT buffer size, larger messages are reassembled from chunks
+#define BENCH_WINDOW 8            // messages in flight before the publisher waits for echoes
+#define BENCH_TIMEOUT_MS 5000     // give up on outstanding echoes after this time
+#define BENCH_MAX_FILTERS 64      // highest fan-in of the scenario table
+#define BENCH_MAX_MESSAGES 1000   // highest message count of the scenario table
+#define BENCH_MAX_PAYLOAD (4 * BENCH_BUFFER_SIZE)
+
+typedef struct
+{
+    int qos;
+    size_t payloadSize;
+    int filters;
+    bool async;
+    int messages;
+} BenchScenario_t;
+
+/**
+ * Scenarios run in this order. Filters are only ever added, so the fan-in
+ * scenarios come last with ascending filter counts.
+ */
+const BenchScenario_t scenarios[] = {
+    {0, 16, 1, false, 1000},
+    {0, 256, 1, false, 1000},
+    {0, BENCH_BUFFER_SIZE, 1, false, 500},
+    {0, BENCH_MAX_PAYLOAD, 1, false, 200},
+    {1, 16, 1, false, 1000},
+    {1, 256, 1, false, 1000},
+    {1, BENCH_BUFFER_SIZE, 1, false, 500},
+    {1, BENCH_MAX_PAYLOAD, 1, false, 200},
+    {2, 16, 1, false, 1000},
+    {2, 256, 1, false, 1000},
+    {2, BENCH_BUFFER_SIZE, 1, false, 500},
+    {2, BENCH_MAX_PAYLOAD, 1, false, 200},
+    {0, 16, 1, true, 1000},
+    {1, 16, 1, true, 1000},
+    {2, 16, 1, true, 1000},
+    {1, BENCH_MAX_PAYLOAD, 1, true, 200},
+    {0, 16, 16, false, 1000},
+    {1, 16, 16, false, 1000},
+    {0, 16, BENCH_MAX_FILTERS, false, 1000},
+    {1, 16, BENCH_MAX_FILTERS, false, 1000},
+};
+
+/**
+ * Book keeping of the messages in flight. Slots are indexed by sequence number
+ * modulo the window. The echo callback and onPublish run in the MQTT task.
+ */
+typedef struct
+{
+    int seq; // -1 once the slot is free again
+    int msgId;
+    int64_t sentAt;
+    bool echoed;
+    bool acked; // QoS 0 messages start acknowledged
+} BenchSlot_t;
+
+PsychicMqttClient mqttClient;
+String baseTopic;
+String filterTopics[BENCH_MAX_FILTERS];
+int registeredFilters = 0;
+
+portMUX_TYPE benchMux = portMUX_INITIALIZER_UNLOCKED;
+BenchSlot_t slots[BENCH_WINDOW];
+int earlyAcks[2 * BENCH_WINDOW]; // acknowledgements arriving before publish() returned the msgId
+int64_t earlyAckTimes[2 * BENCH_WINDOW];
+int earlyAckCount = 0;
+volatile int received = 0;
+volatile int acked = 0;
+uint32_t *echoLatency = nullptr;
+uint32_t *ackLatency = nullptr;
+uint32_t heapLow = UINT32_MAX;
+
+void sampleHeap()
+{
+    uint32_t freeHeap = ESP.getFreeHeap();
+    if (freeHeap < heapLow)
+        heapLow = freeHeap;
+}
+
+void releaseIfDone(BenchSlot_t &slot)
+{
+    if (slot.echoed && slot.acked)
+        slot.seq = -1;
+}
+
+void recordAck(BenchSlot_t &slot, int64_t now)
+{
+    ackLatency[acked] = (uint32_t)(now - slot.sentAt);
+    acked = acked + 1;
+    slot.acked = true;
+    releaseIfDone(slot);
+}
+
+void onEcho(const char *topic, const char *payload, int retain, int qos, bool dup)
+{
+    int64_t now = esp_timer_get_time();
+    char seqHex[9] = {0};
+    strncpy(seqHex, payload, 8);
+    int seq = (int)strtoul(seqHex, nullptr, 16);
+
+    portENTER_CRITICAL(&benchMux);
+    BenchSlot_t &slot = slots[seq % BENCH_WINDOW];
+    if (slot.seq == seq && !slot.echoed)
+    {
+        echoLatency[received] = (uint32_t)(now - slot.sentAt);
+        received = received + 1;
+        slot.echoed = true;
+        releaseIfDone(slot);
+    }
+    portEXIT_CRITICAL(&benchMux);
+    sampleHeap();
+}
+
+void onMqttPublish(int msgId)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&benchMux);
+    bool found = false;
+    for (auto &slot : slots)
+    {
+        if (slot.seq != -1 && slot.msgId == msgId && !slot.acked)
+        {
+            recordAck(slot, now);
+            found = true;
+            break;
+        }
+    }
+    if (!found && earlyAckCount < 2 * BENCH_WINDOW)
+    {
+        earlyAcks[earlyAckCount] = msgId;
+        earlyAckTimes[earlyAckCount] = now;
+        earlyAckCount++;
+    }
+    portEXIT_CRITICAL(&benchMux);
+}
+
+void percentiles(uint32_t *samples, int count, char *out, size_t size)
+{
+    if (count == 0)
+    {
+        snprintf(out, size, "null");
+        return;
+    }
+    std::sort(samples, samples + count);
+    snprintf(out, size, "{\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u}", (unsigned)samples[count * 50 / 100],
+             (unsigned)samples[count * 90 / 100], (unsigned)samples[count * 99 / 100], (unsigned)samples[count - 1]);
+}
+
+bool waitUntil(std::function<bool()> condition, uint32_t timeoutMs)
+{
+    // Yield instead of delay(), a 1 ms tick would cap the message rate at the window size per tick
+    uint32_t start = millis();
+    while (!condition())
+    {
+        if (millis() - start > timeoutMs)
+            return false;
+        yield();
+    }
+    return true;
+}
+
+void addFilters(int filters)
+{
+    // Filters are added while no messages are in flight
+    for (; registeredFilters < filters; registeredFilters++)
+    {
+        filterTopics[registeredFilters] = baseTopic + "/f/" + String(registeredFilters);
+        mqttClient.onTopic(filterTopics[registeredFilters].c_str(), 2, onEcho);
+    }
+    delay(500); // let the subscriptions complete
+}
+
+bool runScenario(const BenchScenario_t &scenario, char *payload)
+{
+    addFilters(scenario.filters);
+
+    portENTER_CRITICAL(&benchMux);
+    for (auto &slot : slots)
+        slot = {-1, -1, 0, false, false};
+    earlyAckCount = 0;
+    received = 0;
+    acked = 0;
+    portEXIT_CRITICAL(&benchMux);
+
+    memset(payload, 'x', scenario.payloadSize);
+    payload[scenario.payloadSize] = '\0';
+    heapLow = UINT32_MAX;
+    sampleHeap();
+    uint32_t heapStart = heapLow;
+
+    int sent = 0;
+    int64_t start = esp_timer_get_time();
+    for (int seq = 0; seq < scenario.messages; seq++)
+    {
+        // Wait until the message sent BENCH_WINDOW messages ago completed
+        BenchSlot_t &slot = slots[seq % BENCH_WINDOW];
+        if (!waitUntil([&]
+                       { return slot.seq == -1; },
+                       BENCH_TIMEOUT_MS))
+            break;
+
+        char seqHex[9];
+        snprintf(seqHex, sizeof(seqHex), "%08x", (unsigned)seq);
+        memcpy(payload, seqHex, 8);
+
+        portENTER_CRITICAL(&benchMux);
+        slot = {seq, -1, esp_timer_get_time(), false, scenario.qos == 0};
+        portEXIT_CRITICAL(&benchMux);
+
+        const char *topic = filterTopics[seq % scenario.filters].c_str();
+        int msgId = mqttClient.publish(topic, scenario.qos, false, payload, scenario.payloadSize, scenario.async);
+        if (msgId < 0)
+            break;
+        sent++;
+        sampleHeap();
+
+        portENTER_CRITICAL(&benchMux);
+        if (slot.seq == seq && scenario.qos > 0)
+        {
+            slot.msgId = msgId;
+            for (int i = 0; i < earlyAckCount; i++)
+            {
+                if (earlyAcks[i] == msgId)
+                {
+                    int64_t ackedAt = earlyAckTimes[i];
+                    earlyAckCount--;
+                    earlyAcks[i] = earlyAcks[earlyAckCount];
+                    earlyAckTimes[i] = earlyAckTimes[earlyAckCount];
+                    recordAck(slot, ackedAt);
+                    break;
+                }
+            }
+        }
+        portEXIT_CRITICAL(&benchMux);
+    }
+
+    waitUntil([&]
+              { return received >= sent && (scenario.qos == 0 || acked >= sent); },
+              BENCH_TIMEOUT_MS);
+    int64_t elapsed = esp_timer_get_time() - start;
+    double seconds = elapsed / 1000000.0;
+
+    char echo[96];
+    char ack[96];
+    int echoes = received;
+    int acks = acked;
+    percentiles(echoLatency, echoes, echo, sizeof(echo));
+    percentiles(ackLatency, scenario.qos > 0 ? acks : 0, ack, sizeof(ack));
+
+    Serial.printf("{\"bench\":\"psychic-mqtt\",\"version\":\"%s\",\"qos\":%d,\"payload\":%u,\"filters\":%d,"
+                  "\"async\":%s,\"messages\":%d,\"sent\":%d,\"received\":%d,\"seconds\":%.3f,"
+                  "\"msgsPerSec\":%.1f,\"bytesPerSec\":%.1f,\"echoUs\":%s,\"ackUs\":%s,"
+                  "\"heapUsedPeak\":%u,\"heapMinFree\":%u}\r\n",
+                  PSYCHIC_MQTT_CLIENT_VERSION_STR, scenario.qos, (unsigned)scenario.payloadSize, scenario.filters,
+                  scenario.async ? "true" : "false", scenario.messages, sent, echoes, seconds,
+                  echoes / seconds, echoes * (double)scenario.payloadSize / seconds, echo, ack,
+                  (unsigned)(heapStart - heapLow), (unsigned)ESP.getMinFreeHeap());
+    return sent == scenario.messages && echoes == sent;
+}
+
+void setup()
+{
+    Serial.begin(115200);
+
+    WiFi.begin(ssid, pass);
+    while (WiFi.status() != WL_CONNECTED)
+    {
+        delay(500);
+    }
+
+    baseTopic = String(ESP.getEfuseMac()) + "/bench";
+    echoLatency = (uint32_t *)malloc(BENCH_MAX_MESSAGES * sizeof(uint32_t));
+    ackLatency = (uint32_t *)malloc(BENCH_MAX_MESSAGES * sizeof(uint32_t));
+    char *payload = (char *)malloc(BENCH_MAX_PAYLOAD + 1);
+
+    mqttClient.setServer(broker);
+    mqttClient.setBufferSize(BENCH_BUFFER_SIZE);
+    mqttClient.onPublish(onMqttPublish);
+    addFilters(1);
+    mqttClient.connect();
+    mqttClient.waitFor(PSYCHIC_MQTT_STATE_CONNECTED);
+    delay(500);
+
+    int failed = 0;
+    for (const auto &scenario : scenarios)
+    {
+        if (!runScenario(scenario, payload))
+            failed++;
+    }
+
+    Serial.printf("Benchmark done, %d of %u scenarios incomplete.\r\n", failed,
+                  (unsigned)(sizeof(scenarios) / sizeof(scenarios[0])));
+    mqttClient.disconnect();
+    free(payload);
+
+#ifdef PSYCHIC_MQTT_HOST
+    exit(failed == 0 ? 0 : 1);
+#endif
+}
+
+void loop()
+{
+    /**
+     * Nothing to do here, the benchmark runs once in setup().
+     */
+}
@@ -0,0 +1,86 @@
+/**
+ *   PsychicMqttClient
+ *
+ *   Coroutines Example for awaiting connect, subscribe and publish with C++20
+ *   coroutines instead of chaining callbacks.
+ *
+ *   Please change the ssid and pass to your actual WiFi credentials.
+ *
+ *   Requires a toolchain with C++20, e.g. Arduino ESP32 3.x. This example
+ *   uses the public MQTT broker broker.hivemq.com, subscribes to a unique
+ *   topic and publishes a few QoS 1 messages to it, each one after the
+ *   previous one was acknowledged.
+ *
+ */
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <PsychicMqttClient.h>
+
+#ifndef PSYCHIC_MQTT_COROUTINES
+#error "This example requires C++20 coroutines"
+#endif
+
+const char ssid[] = "ssid"; // your network SSID (name)
+const char pass[] = "pass"; // your network password
+
+PsychicMqttClient mqttClient;
+
+String topic = String(ESP.getEfuseMac()) + "/coroutines";
+
+/**
+ * A coroutine runs until the first co_await in the calling task, then in the task that
+ * completed the awaited operation, usually the MQTT task. Like in any callback, do not
+ * block or delay in it.
+ */
+PsychicMqttTask publishCounter()
+{
+    if (!co_await mqttClient.connectedAsync())
+        co_return;
+
+    PsychicMqttAwaitResult_t subscribed = co_await mqttClient.subscribeAsync(topic.c_str(), 1);
+    Serial.printf("Subscribed with status %d after %u us\r\n", subscribed.status, subscribed.rtt);
+
+    for (int i = 0; i < 5; i++)
+    {
+        char payload[16];
+        snprintf(payload, sizeof(payload), "%d", i);
+        PsychicMqttAwaitResult_t published = co_await mqttClient.publishAsync(topic.c_str(), 1, false, payload);
+        if (published.status == PSYCHIC_MQTT_PUBLISH_ACKNOWLEDGED)
+            Serial.printf("Message %d acknowledged after %u us\r\n", i, published.rtt);
+        else
+            Serial.printf("Message %d failed with status %d\r\n", i, published.status);
+    }
+}
+
+void setup()
+{
+    Serial.begin(115200);
+
+    WiFi.begin(ssid, pass);
+
+    Serial.printf("Connecting to WiFi %s .", ssid);
+    while (WiFi.status() != WL_CONNECTED)
+    {
+        Serial.print(".");
+        delay(500);
+    }
+
+    Serial.printf("\r\nConnected, IP address: %s \r\n", WiFi.localIP().toString().c_str());
+
+    mqttClient.setServer("mqtt://broker.hivemq.com");
+
+    mqttClient.onMessage([&](char *topic, char *payload, int retain, int qos, bool dup)
+                         { Serial.printf("Received %s: %s\r\n", topic, payload); });
+
+    /**
+     * The coroutine suspends until the client is connected.
+     */
+    publishCounter();
+
+    mqttClient.connect();
+}
+
+void loop()
+{
+}
@@ -212,12 +212,10 @@ void setup()
     mqttClient.connect();
 
     /**
-     * Wait blocking until the connection is established
+     * Wait blocking until the connection is established. The task sleeps until the
+     * client reports the state change.
      */
-    while (!mqttClient.connected())
-    {
-        delay(500);
-    }
+    mqttClient.waitFor(PSYCHIC_MQTT_STATE_CONNECTED);
 
     /**
      * Publish a message to the topic "{MAC-Address}/simple" with QoS 0 and retain flag 0.
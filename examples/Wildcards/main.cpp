@@ -91,10 +91,7 @@ void setup()
 
     mqttClient.connect();
 
-    while (!mqttClient.connected())
-    {
-        delay(500);
-    }
+    mqttClient.waitFor(PSYCHIC_MQTT_STATE_CONNECTED);
 
     delay(RECEIVE_DELAY);
 }
@@ -0,0 +1,70 @@
+#pragma once
+/**
+ *   PsychicMqttClient host shim
+ *
+ *   Arduino String on top of std::string, covering what the library and the
+ *   examples use.
+ */
+
+#include <stdint.h>
+#include <string>
+
+class String
+{
+public:
+    String(const char *cstr = "") : _s(cstr != nullptr ? cstr : "") {}
+    String(const std::string &s) : _s(s) {}
+    String(char c) : _s(1, c) {}
+    explicit String(int value, unsigned char base = 10);
+    explicit String(unsigned int value, unsigned char base = 10);
+    explicit String(long value, unsigned char base = 10);
+    explicit String(unsigned long value, unsigned char base = 10);
+    explicit String(long long value, unsigned char base = 10);
+    explicit String(unsigned long long value, unsigned char base = 10);
+    explicit String(float value, unsigned int decimalPlaces = 2);
+    explicit String(double value, unsigned int decimalPlaces = 2);
+
+    const char *c_str() const { return _s.c_str(); }
+    unsigned int length() const { return _s.length(); }
+    bool isEmpty() const { return _s.empty(); }
+    char charAt(unsigned int index) const { return index < _s.length() ? _s[index] : 0; }
+    char operator[](unsigned int index) const { return charAt(index); }
+
+    int indexOf(char ch, unsigned int fromIndex = 0) const;
+    int indexOf(const String &str, unsigned int fromIndex = 0) const;
+    int lastIndexOf(char ch) const;
+    int lastIndexOf(const String &str) const;
+    String substring(unsigned int beginIndex) const;
+    String substring(unsigned int beginIndex, unsigned int endIndex) const;
+    bool startsWith(const String &prefix) const;
+    bool endsWith(const String &suffix) const;
+    long toInt() const;
+
+    String &operator+=(const String &rhs)
+    {
+        _s += rhs._s;
+        return *this;
+    }
+    String &operator+=(const char *rhs)
+    {
+        _s += rhs;
+        return *this;
+    }
+    String &operator+=(char rhs)
+    {
+        _s += rhs;
+        return *this;
+    }
+    friend String operator+(const String &lhs, const String &rhs) { return String(lhs._s + rhs._s); }
+    friend String operator+(const String &lhs, const char *rhs) { return String(lhs._s + rhs); }
+    friend String operator+(const char *lhs, const String &rhs) { return String(lhs + rhs._s); }
+
+    bool operator==(const String &rhs) const { return _s == rhs._s; }
+    bool operator!=(const String &rhs) const { return _s != rhs._s; }
+    bool operator==(const char *rhs) const { return _s == rhs; }
+    bool operator!=(const char *rhs) const { return _s != rhs; }
+    bool operator<(const String &rhs) const { return _s < rhs._s; }
+
+private:
+    std::string _s;
+};
@@ -0,0 +1,39 @@
+#pragma once
+/**
+ *   PsychicMqttClient host shim
+ *
+ *   The host is always connected. WiFi.begin() returns immediately.
+ */
+
+#include "Arduino.h"
+
+typedef enum
+{
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+class IPAddress
+{
+public:
+    IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) : _bytes{a, b, c, d} {}
+    String toString() const;
+
+private:
+    uint8_t _bytes[4];
+};
+
+class WiFiClass
+{
+public:
+    wl_status_t begin(const char *ssid, const char *passphrase = nullptr);
+    wl_status_t status() { return WL_CONNECTED; }
+    bool disconnect(bool wifioff = false);
+    IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+};
+
+extern WiFiClass WiFi;
@@ -0,0 +1,15 @@
+#pragma once
+/**
+ *   PsychicMqttClient host shim
+ *
+ *   TLS is not supported on the host. The certificate bundle functions are no-ops.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+esp_err_t esp_crt_bundle_attach(void *conf);
+void esp_crt_bundle_detach(void *conf);
+esp_err_t esp_crt_bundle_set(const uint8_t *x509_bundle, size_t bundle_size);
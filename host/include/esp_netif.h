@@ -0,0 +1,11 @@
+#pragma once
+/**
+ *   PsychicMqttClient host shim
+ *
+ *   The host network is always up. There is no default netif.
+ */
+
+typedef struct esp_netif_obj esp_netif_t;
+
+esp_netif_t *esp_netif_get_default_netif(void);
+bool esp_netif_is_netif_up(esp_netif_t *esp_netif);
@@ -0,0 +1,15 @@
+#pragma once
+/**
+ *   PsychicMqttClient host shim
+ *
+ *   Heap figures are taken from mallinfo2(). "Free" heap is reported relative to
+ *   a virtual 4 GB heap, so the minimum free heap tracks the high-water mark of
+ *   the allocated bytes.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+void esp_restart(void);
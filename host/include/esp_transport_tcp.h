@@ -0,0 +1,10 @@
+#pragma once
+/**
+ *   PsychicMqttClient host shim
+ *
+ *   Plain TCP transport on POSIX sockets.
+ */
+
+#include "esp_transport.h"
+
+esp_transport_handle_t esp_transport_tcp_init(void);
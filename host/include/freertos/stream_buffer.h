@@ -0,0 +1,18 @@
+#pragma once
+/**
+ *   PsychicMqttClient host shim
+ */
+
+#include <stddef.h>
+
+#include "FreeRTOS.h"
+
+typedef struct host_stream_buffer *StreamBufferHandle_t;
+
+StreamBufferHandle_t xStreamBufferCreate(size_t bufferSize, size_t triggerLevel);
+size_t xStreamBufferSend(StreamBufferHandle_t buffer, const void *data, size_t length, TickType_t ticksToWait);
+size_t xStreamBufferReceive(StreamBufferHandle_t buffer, void *data, size_t length, TickType_t ticksToWait);
+size_t xStreamBufferBytesAvailable(StreamBufferHandle_t buffer);
+size_t xStreamBufferSpacesAvailable(StreamBufferHandle_t buffer);
+BaseType_t xStreamBufferReset(StreamBufferHandle_t buffer);
+void vStreamBufferDelete(StreamBufferHandle_t buffer);
@@ -0,0 +1,309 @@
+/**
+ *   PsychicMqttClient host shim
+ *
+ *   Arduino core functions, String, Print, Serial, ESP and WiFi.
+ */
+
+#include "Arduino.h"
+#include "WiFi.h"
+
+#include <sched.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+HardwareSerial Serial;
+EspClass ESP;
+WiFiClass WiFi;
+
+static int64_t monotonic_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static const int64_t boot_us = monotonic_us();
+
+unsigned long millis()
+{
+    return (unsigned long)((monotonic_us() - boot_us) / 1000);
+}
+
+unsigned long micros()
+{
+    return (unsigned long)(monotonic_us() - boot_us);
+}
+
+void delay(uint32_t ms)
+{
+    usleep((useconds_t)ms * 1000);
+}
+
+void yield()
+{
+    sched_yield();
+}
+
+/*------------------------------------------------------------------------------------------------*/
+// String
+/*------------------------------------------------------------------------------------------------*/
+
+template <typename T>
+static std::string format_integer(T value, unsigned char base)
+{
+    if (base < 2 || base > 36)
+        base = 10;
+    bool negative = value < 0;
+    std::string digits;
+    do
+    {
+        int digit = (int)(value % (T)base);
+        if (digit < 0)
+            digit = -digit;
+        digits += (char)(digit < 10 ? '0' + digit : 'a' + digit - 10);
+        value /= (T)base;
+    } while (value != 0);
+    if (negative)
+        digits += '-';
+    std::reverse(digits.begin(), digits.end());
+    return digits;
+}
+
+String::String(int value, unsigned char base) : _s(format_integer(value, base)) {}
+String::String(unsigned int value, unsigned char base) : _s(format_integer(value, base)) {}
+String::String(long value, unsigned char base) : _s(format_integer(value, base)) {}
+String::String(unsigned long value, unsigned char base) : _s(format_integer(value, base)) {}
+String::String(long long value, unsigned char base) : _s(format_integer(value, base)) {}
+String::String(unsigned long long value, unsigned char base) : _s(format_integer(value, base)) {}
+
+String::String(float value, unsigned int decimalPlaces) : String((double)value, decimalPlaces) {}
+
+String::String(double value, unsigned int decimalPlaces)
+{
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%.*f", (int)decimalPlaces, value);
+    _s = buffer;
+}
+
+int String::indexOf(char ch, unsigned int fromIndex) const
+{
+    size_t index = _s.find(ch, fromIndex);
+    return index == std::string::npos ? -1 : (int)index;
+}
+
+int String::indexOf(const String &str, unsigned int fromIndex) const
+{
+    size_t index = _s.find(str._s, fromIndex);
+    return index == std::string::npos ? -1 : (int)index;
+}
+
+int String::lastIndexOf(char ch) const
+{
+    size_t index = _s.rfind(ch);
+    return index == std::string::npos ? -1 : (int)index;
+}
+
+int String::lastIndexOf(const String &str) const
+{
+    size_t index = _s.rfind(str._s);
+    return index == std::string::npos ? -1 : (int)index;
+}
+
+String String::substring(unsigned int beginIndex) const
+{
+    return substring(beginIndex, _s.length());
+}
+
+String String::substring(unsigned int beginIndex, unsigned int endIndex) const
+{
+    // Arduino semantics: indices are swapped if needed and clamped to the length
+    if (beginIndex > endIndex)
+        std::swap(beginIndex, endIndex);
+    if (beginIndex >= _s.length())
+        return String();
+    endIndex = std::min<unsigned int>(endIndex, _s.length());
+    return String(_s.substr(beginIndex, endIndex - beginIndex));
+}
+
+bool String::startsWith(const String &prefix) const
+{
+    return _s.compare(0, prefix._s.length(), prefix._s) == 0;
+}
+
+bool String::endsWith(const String &suffix) const
+{
+    return _s.length() >= suffix._s.length() &&
+           _s.compare(_s.length() - suffix._s.length(), suffix._s.length(), suffix._s) == 0;
+}
+
+long String::toInt() const
+{
+    return strtol(_s.c_str(), nullptr, 10);
+}
+
+/*------------------------------------------------------------------------------------------------*/
+// Print
+/*------------------------------------------------------------------------------------------------*/
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t n = 0;
+    while (size--)
+    {
+        if (write(*buffer++) == 0)
+            break;
+        n++;
+    }
+    return n;
+}
+
+size_t Print::write(const char *str)
+{
+    return str == nullptr ? 0 : write((const uint8_t *)str, strlen(str));
+}
+
+size_t Print::printf(const char *format, ...)
+{
+    char stackBuffer[128];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(stackBuffer, sizeof(stackBuffer), format, args);
+    va_end(args);
+    if (len < 0)
+        return 0;
+    if ((size_t)len < sizeof(stackBuffer))
+        return write((const uint8_t *)stackBuffer, len);
+
+    char *buffer = (char *)malloc(len + 1);
+    if (buffer == nullptr)
+        return 0;
+    va_start(args, format);
+    vsnprintf(buffer, len + 1, format, args);
+    va_end(args);
+    size_t n = write((const uint8_t *)buffer, len);
+    free(buffer);
+    return n;
+}
+
+size_t Print::print(const char *str) { return write(str); }
+size_t Print::print(const String &str) { return write(str.c_str()); }
+size_t Print::print(char c) { return write((uint8_t)c); }
+size_t Print::print(int value) { return printf("%d", value); }
+size_t Print::print(unsigned int value) { return printf("%u", value); }
+size_t Print::print(long value) { return printf("%ld", value); }
+size_t Print::print(unsigned long value) { return printf("%lu", value); }
+size_t Print::print(double value, int digits) { return printf("%.*f", digits, value); }
+
+size_t Print::println() { return write("\r\n"); }
+size_t Print::println(const char *str) { return print(str) + println(); }
+size_t Print::println(const String &str) { return print(str) + println(); }
+size_t Print::println(char c) { return print(c) + println(); }
+size_t Print::println(int value) { return print(value) + println(); }
+size_t Print::println(unsigned int value) { return print(value) + println(); }
+size_t Print::println(long value) { return print(value) + println(); }
+size_t Print::println(unsigned long value) { return print(value) + println(); }
+size_t Print::println(double value, int digits) { return print(value, digits) + println(); }
+
+/*------------------------------------------------------------------------------------------------*/
+// Stream
+/*------------------------------------------------------------------------------------------------*/
+
+size_t Stream::readBytes(char *buffer, size_t length)
+{
+    size_t n = 0;
+    unsigned long start = millis();
+    while (n < length && millis() - start < _timeout)
+    {
+        int c = read();
+        if (c < 0)
+        {
+            delay(1);
+            continue;
+        }
+        buffer[n++] = (char)c;
+        start = millis();
+    }
+    return n;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+// Serial, ESP and WiFi
+/*------------------------------------------------------------------------------------------------*/
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    return fwrite(&c, 1, 1, stdout);
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+    return fwrite(buffer, 1, size, stdout);
+}
+
+void HardwareSerial::flush()
+{
+    fflush(stdout);
+}
+
+uint64_t EspClass::getEfuseMac()
+{
+    // Stable per host and process so parallel runs use distinct topics
+    char hostname[64] = {0};
+    gethostname(hostname, sizeof(hostname) - 1);
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char *p = hostname; *p; p++)
+        hash = (hash ^ (uint8_t)*p) * 1099511628211ULL;
+    hash ^= (uint64_t)getpid() << 16;
+    return hash & 0xffffffffffffULL;
+}
+
+uint32_t EspClass::getFreeHeap()
+{
+    return esp_get_free_heap_size();
+}
+
+uint32_t EspClass::getMinFreeHeap()
+{
+    return esp_get_minimum_free_heap_size();
+}
+
+void EspClass::restart()
+{
+    esp_restart();
+}
+
+String IPAddress::toString() const
+{
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", _bytes[0], _bytes[1], _bytes[2], _bytes[3]);
+    return String(buffer);
+}
+
+wl_status_t WiFiClass::begin(const char *ssid, const char *passphrase)
+{
+    (void)ssid;
+    (void)passphrase;
+    return WL_CONNECTED;
+}
+
+bool WiFiClass::disconnect(bool wifioff)
+{
+    (void)wifioff;
+    return true;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+// Certificate bundle symbols, normally embedded from src/certs/x509_crt_bundle.bin by the build
+/*------------------------------------------------------------------------------------------------*/
+
+// Empty bundle: start and end share an address
+asm(".section .rodata\n"
+    ".globl _binary_src_certs_x509_crt_bundle_bin_start\n"
+    ".globl _binary_src_certs_x509_crt_bundle_bin_end\n"
+    "_binary_src_certs_x509_crt_bundle_bin_start:\n"
+    "_binary_src_certs_x509_crt_bundle_bin_end:\n"
+    ".byte 0\n"
+    ".previous\n");
@@ -0,0 +1,20 @@
+/**
+ *   PsychicMqttClient host shim
+ *
+ *   Runs the Arduino sketch: setup() once, then loop() until the process exits.
+ *   loop() is paced at about 1 kHz so idle sketches do not spin a host core.
+ */
+
+#include "Arduino.h"
+
+int main()
+{
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    setup();
+    while (true)
+    {
+        loop();
+        delay(1);
+    }
+    return 0;
+}
@@ -0,0 +1,94 @@
+/**
+ *   PsychicMqttClient host shim
+ */
+
+#include "esp_log.h"
+#include "esp_err.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+
+static esp_log_level_t initial_level()
+{
+    const char *env = getenv("ESP_LOG_LEVEL");
+    if (env != nullptr && *env >= '0' && *env <= '5')
+        return (esp_log_level_t)(*env - '0');
+    return ESP_LOG_INFO;
+}
+
+static esp_log_level_t log_level = initial_level();
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    // Per tag levels are not supported, every tag follows the global level
+    (void)tag;
+    log_level = level;
+}
+
+esp_log_level_t esp_log_level_get(void)
+{
+    return log_level;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    static const char letters[] = "NEWIDV";
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    // Format into one buffer so lines from different threads do not interleave
+    char line[512];
+    int len = snprintf(line, sizeof(line), "%c (%lld) %s: ", letters[level], (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000,
+                       tag);
+    va_list args;
+    va_start(args, format);
+    if (len < (int)sizeof(line))
+        len += vsnprintf(line + len, sizeof(line) - len, format, args);
+    va_end(args);
+    if (len >= (int)sizeof(line) - 1)
+        len = sizeof(line) - 2;
+    line[len++] = '\n';
+    fwrite(line, 1, len, stderr);
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_FAIL:
+        return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+        return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+        return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:
+        return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:
+        return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED:
+        return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:
+        return "ESP_ERR_TIMEOUT";
+    default:
+        return "UNKNOWN ERROR";
+    }
+}
+
+void _esp_error_check_failed(esp_err_t rc, const char *file, int line, const char *function, const char *expression)
+{
+    fprintf(stderr, "ESP_ERROR_CHECK failed: esp_err_t 0x%x (%s) at %s:%d\nfunction: %s\nexpression: %s\n", rc,
+            esp_err_to_name(rc), file, line, function, expression);
+    abort();
+}
+
+void _esp_error_check_failed_without_abort(esp_err_t rc, const char *file, int line, const char *function,
+                                           const char *expression)
+{
+    fprintf(stderr, "ESP_ERROR_CHECK_WITHOUT_ABORT failed: esp_err_t 0x%x (%s) at %s:%d\nfunction: %s\nexpression: %s\n",
+            rc, esp_err_to_name(rc), file, line, function, expression);
+}
@@ -0,0 +1,72 @@
+/**
+ *   PsychicMqttClient host shim
+ *
+ *   Heap figures, the certificate bundle and the netif stubs.
+ */
+
+#include "esp_system.h"
+#include "esp_crt_bundle.h"
+#include "esp_netif.h"
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+
+static const uint64_t virtual_heap_size = 0xffffffffULL;
+static std::atomic<uint32_t> minimum_free_heap(0xffffffffUL);
+
+uint32_t esp_get_free_heap_size(void)
+{
+    struct mallinfo2 info = mallinfo2();
+    uint64_t used = info.uordblks + info.hblkhd;
+    uint32_t free = used >= virtual_heap_size ? 0 : (uint32_t)(virtual_heap_size - used);
+
+    uint32_t minimum = minimum_free_heap.load(std::memory_order_relaxed);
+    while (free < minimum && !minimum_free_heap.compare_exchange_weak(minimum, free, std::memory_order_relaxed))
+    {
+    }
+    return free;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    // Sample now so the high-water mark includes the current allocation
+    esp_get_free_heap_size();
+    return minimum_free_heap.load(std::memory_order_relaxed);
+}
+
+void esp_restart(void)
+{
+    fprintf(stderr, "esp_restart() called, exiting\n");
+    exit(0);
+}
+
+esp_err_t esp_crt_bundle_attach(void *conf)
+{
+    (void)conf;
+    return ESP_OK;
+}
+
+void esp_crt_bundle_detach(void *conf)
+{
+    (void)conf;
+}
+
+esp_err_t esp_crt_bundle_set(const uint8_t *x509_bundle, size_t bundle_size)
+{
+    (void)x509_bundle;
+    (void)bundle_size;
+    return ESP_OK;
+}
+
+esp_netif_t *esp_netif_get_default_netif(void)
+{
+    return nullptr;
+}
+
+bool esp_netif_is_netif_up(esp_netif_t *)
+{
+    return true;
+}
@@ -0,0 +1,168 @@
+/**
+ *   PsychicMqttClient host shim
+ *
+ *   esp_timer with a single dispatch thread. Armed timers are kept in a list
+ *   ordered by their next expiry.
+ */
+
+#include "esp_timer.h"
+
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct esp_timer
+{
+    esp_timer_cb_t callback;
+    void *arg;
+    int64_t expiry;
+    uint64_t period;
+    bool armed;
+};
+
+// Never destroyed, the detached dispatch thread still waits on them while the process exits
+static std::mutex &timer_mutex = *new std::mutex();
+static std::condition_variable &timer_cv = *new std::condition_variable();
+static std::vector<esp_timer *> &armed_timers = *new std::vector<esp_timer *>();
+static esp_timer *running_timer = nullptr;
+static std::condition_variable &running_cv = *new std::condition_variable();
+static std::thread::id dispatcher_id;
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void insert_timer(esp_timer *timer)
+{
+    auto position = std::upper_bound(armed_timers.begin(), armed_timers.end(), timer,
+                                     [](const esp_timer *a, const esp_timer *b)
+                                     { return a->expiry < b->expiry; });
+    armed_timers.insert(position, timer);
+    timer->armed = true;
+}
+
+static void remove_timer(esp_timer *timer)
+{
+    auto position = std::find(armed_timers.begin(), armed_timers.end(), timer);
+    if (position != armed_timers.end())
+        armed_timers.erase(position);
+    timer->armed = false;
+}
+
+static void dispatch_timers()
+{
+    std::unique_lock<std::mutex> lock(timer_mutex);
+    while (true)
+    {
+        if (armed_timers.empty())
+        {
+            timer_cv.wait(lock);
+            continue;
+        }
+        esp_timer *timer = armed_timers.front();
+        int64_t now = esp_timer_get_time();
+        if (timer->expiry > now)
+        {
+            timer_cv.wait_for(lock, std::chrono::microseconds(timer->expiry - now));
+            continue;
+        }
+        armed_timers.erase(armed_timers.begin());
+        timer->armed = false;
+        if (timer->period > 0)
+        {
+            timer->expiry += timer->period;
+            if (timer->expiry < now)
+                timer->expiry = now + timer->period;
+            insert_timer(timer);
+        }
+
+        // Run the callback unlocked so it may start or stop timers
+        running_timer = timer;
+        lock.unlock();
+        timer->callback(timer->arg);
+        lock.lock();
+        running_timer = nullptr;
+        running_cv.notify_all();
+    }
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    if (create_args == nullptr || create_args->callback == nullptr || out_handle == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(timer_mutex);
+    if (dispatcher_id == std::thread::id())
+    {
+        std::thread dispatcher(dispatch_timers);
+        dispatcher_id = dispatcher.get_id();
+        dispatcher.detach();
+    }
+    *out_handle = new esp_timer{create_args->callback, create_args->arg, 0, 0, false};
+    return ESP_OK;
+}
+
+static esp_err_t start_timer(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period)
+{
+    if (timer == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(timer_mutex);
+    if (timer->armed)
+        return ESP_ERR_INVALID_STATE;
+    timer->expiry = esp_timer_get_time() + timeout_us;
+    timer->period = period;
+    insert_timer(timer);
+    timer_cv.notify_one();
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return start_timer(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    return start_timer(timer, period, period);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (timer == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(timer_mutex);
+    if (!timer->armed)
+        return ESP_ERR_INVALID_STATE;
+    remove_timer(timer);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    if (timer == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    std::unique_lock<std::mutex> lock(timer_mutex);
+    if (timer->armed)
+        return ESP_ERR_INVALID_STATE;
+    // Deleting from another thread waits for a running callback, deleting from within it is allowed
+    if (std::this_thread::get_id() != dispatcher_id)
+    {
+        running_cv.wait(lock, [timer]
+                        { return running_timer != timer; });
+    }
+    delete timer;
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+    std::lock_guard<std::mutex> lock(timer_mutex);
+    return timer != nullptr && timer->armed;
+}
@@ -0,0 +1,309 @@
+/**
+ *   PsychicMqttClient host shim
+ *
+ *   Transport dispatch and the plain TCP transport.
+ */
+
+#include "esp_transport.h"
+#include "esp_transport_tcp.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+struct esp_transport_item_t
+{
+    connect_func _connect;
+    io_read_func _read;
+    io_func _write;
+    trans_func _close;
+    poll_func _poll_read;
+    poll_func _poll_write;
+    trans_func _destroy;
+    void *data;
+    int default_port;
+    int last_errno;
+};
+
+esp_transport_handle_t esp_transport_init(void)
+{
+    esp_transport_handle_t t = (esp_transport_handle_t)calloc(1, sizeof(esp_transport_item_t));
+    return t;
+}
+
+esp_err_t esp_transport_destroy(esp_transport_handle_t t)
+{
+    if (t == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    if (t->_destroy != nullptr)
+        t->_destroy(t);
+    free(t);
+    return ESP_OK;
+}
+
+esp_err_t esp_transport_set_func(esp_transport_handle_t t, connect_func _connect, io_read_func _read, io_func _write,
+                                 trans_func _close, poll_func _poll_read, poll_func _poll_write, trans_func _destroy)
+{
+    if (t == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    t->_connect = _connect;
+    t->_read = _read;
+    t->_write = _write;
+    t->_close = _close;
+    t->_poll_read = _poll_read;
+    t->_poll_write = _poll_write;
+    t->_destroy = _destroy;
+    return ESP_OK;
+}
+
+esp_err_t esp_transport_set_context_data(esp_transport_handle_t t, void *data)
+{
+    if (t == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    t->data = data;
+    return ESP_OK;
+}
+
+void *esp_transport_get_context_data(esp_transport_handle_t t)
+{
+    return t != nullptr ? t->data : nullptr;
+}
+
+esp_err_t esp_transport_set_default_port(esp_transport_handle_t t, int port)
+{
+    if (t == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    t->default_port = port;
+    return ESP_OK;
+}
+
+int esp_transport_connect(esp_transport_handle_t t, const char *host, int port, int timeout_ms)
+{
+    if (t == nullptr || t->_connect == nullptr)
+        return -1;
+    if (port <= 0)
+        port = t->default_port;
+    int ret = t->_connect(t, host, port, timeout_ms);
+    t->last_errno = ret < 0 ? errno : 0;
+    return ret;
+}
+
+int esp_transport_read(esp_transport_handle_t t, char *buffer, int len, int timeout_ms)
+{
+    if (t == nullptr || t->_read == nullptr)
+        return -1;
+    int ret = t->_read(t, buffer, len, timeout_ms);
+    if (ret < 0)
+        t->last_errno = errno;
+    return ret;
+}
+
+int esp_transport_write(esp_transport_handle_t t, const char *buffer, int len, int timeout_ms)
+{
+    if (t == nullptr || t->_write == nullptr)
+        return -1;
+    int ret = t->_write(t, buffer, len, timeout_ms);
+    if (ret < 0)
+        t->last_errno = errno;
+    return ret;
+}
+
+int esp_transport_poll_read(esp_transport_handle_t t, int timeout_ms)
+{
+    if (t == nullptr || t->_poll_read == nullptr)
+        return -1;
+    return t->_poll_read(t, timeout_ms);
+}
+
+int esp_transport_poll_write(esp_transport_handle_t t, int timeout_ms)
+{
+    if (t == nullptr || t->_poll_write == nullptr)
+        return -1;
+    return t->_poll_write(t, timeout_ms);
+}
+
+int esp_transport_close(esp_transport_handle_t t)
+{
+    if (t == nullptr)
+        return -1;
+    return t->_close != nullptr ? t->_close(t) : 0;
+}
+
+int esp_transport_get_errno(esp_transport_handle_t t)
+{
+    return t != nullptr ? t->last_errno : -1;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+// TCP transport
+/*------------------------------------------------------------------------------------------------*/
+
+typedef struct
+{
+    int sock;
+} tcp_transport_t;
+
+static int tcp_poll(int sock, short events, int timeout_ms)
+{
+    struct pollfd pfd = {sock, events, 0};
+    int ret;
+    do
+    {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
+    if (ret > 0 && (pfd.revents & (POLLERR | POLLNVAL)))
+        return -1;
+    return ret;
+}
+
+static int tcp_close(esp_transport_handle_t t)
+{
+    tcp_transport_t *tcp = (tcp_transport_t *)esp_transport_get_context_data(t);
+    if (tcp->sock >= 0)
+    {
+        close(tcp->sock);
+        tcp->sock = -1;
+    }
+    return 0;
+}
+
+static int tcp_connect(esp_transport_handle_t t, const char *host, int port, int timeout_ms)
+{
+    tcp_transport_t *tcp = (tcp_transport_t *)esp_transport_get_context_data(t);
+    tcp_close(t);
+
+    char service[8];
+    snprintf(service, sizeof(service), "%d", port);
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *result = nullptr;
+    if (getaddrinfo(host, service, &hints, &result) != 0 || result == nullptr)
+    {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+
+    int sock = -1;
+    for (struct addrinfo *ai = result; ai != nullptr; ai = ai->ai_next)
+    {
+        sock = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (sock < 0)
+            continue;
+
+        // Non-blocking connect so the timeout is honored
+        int flags = fcntl(sock, F_GETFL, 0);
+        fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+        int ret = connect(sock, ai->ai_addr, ai->ai_addrlen);
+        if (ret < 0 && errno == EINPROGRESS)
+        {
+            // Completion or failure is reported through SO_ERROR once the socket is writable
+            struct pollfd pfd = {sock, POLLOUT, 0};
+            if (poll(&pfd, 1, timeout_ms) > 0)
+            {
+                int error = 0;
+                socklen_t len = sizeof(error);
+                getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &len);
+                ret = error == 0 ? 0 : -1;
+                errno = error;
+            }
+            else
+            {
+                errno = ETIMEDOUT;
+            }
+        }
+        fcntl(sock, F_SETFL, flags);
+        if (ret == 0)
+            break;
+        int savedErrno = errno;
+        close(sock);
+        errno = savedErrno;
+        sock = -1;
+    }
+    freeaddrinfo(result);
+    if (sock < 0)
+        return -1;
+
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    tcp->sock = sock;
+    return 0;
+}
+
+static int tcp_read(esp_transport_handle_t t, char *buffer, int len, int timeout_ms)
+{
+    tcp_transport_t *tcp = (tcp_transport_t *)esp_transport_get_context_data(t);
+    int ready = tcp_poll(tcp->sock, POLLIN, timeout_ms);
+    if (ready <= 0)
+        return ready;
+    ssize_t ret;
+    do
+    {
+        ret = recv(tcp->sock, buffer, len, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret == 0)
+    {
+        // Orderly shutdown by the peer
+        errno = ENOTCONN;
+        return -1;
+    }
+    return (int)ret;
+}
+
+static int tcp_write(esp_transport_handle_t t, const char *buffer, int len, int timeout_ms)
+{
+    tcp_transport_t *tcp = (tcp_transport_t *)esp_transport_get_context_data(t);
+    int ready = tcp_poll(tcp->sock, POLLOUT, timeout_ms);
+    if (ready <= 0)
+        return ready;
+    ssize_t ret;
+    do
+    {
+        ret = send(tcp->sock, buffer, len, MSG_NOSIGNAL);
+    } while (ret < 0 && errno == EINTR);
+    return (int)ret;
+}
+
+static int tcp_poll_read(esp_transport_handle_t t, int timeout_ms)
+{
+    tcp_transport_t *tcp = (tcp_transport_t *)esp_transport_get_context_data(t);
+    return tcp_poll(tcp->sock, POLLIN, timeout_ms);
+}
+
+static int tcp_poll_write(esp_transport_handle_t t, int timeout_ms)
+{
+    tcp_transport_t *tcp = (tcp_transport_t *)esp_transport_get_context_data(t);
+    return tcp_poll(tcp->sock, POLLOUT, timeout_ms);
+}
+
+static int tcp_destroy(esp_transport_handle_t t)
+{
+    tcp_close(t);
+    free(esp_transport_get_context_data(t));
+    return 0;
+}
+
+esp_transport_handle_t esp_transport_tcp_init(void)
+{
+    esp_transport_handle_t t = esp_transport_init();
+    tcp_transport_t *tcp = (tcp_transport_t *)calloc(1, sizeof(tcp_transport_t));
+    if (t == nullptr || tcp == nullptr)
+    {
+        free(t);
+        free(tcp);
+        return nullptr;
+    }
+    tcp->sock = -1;
+    esp_transport_set_context_data(t, tcp);
+    esp_transport_set_func(t, tcp_connect, tcp_read, tcp_write, tcp_close, tcp_poll_read, tcp_poll_write, tcp_destroy);
+    esp_transport_set_default_port(t, 1883);
+    return t;
+}
@@ -0,0 +1,461 @@
+/**
+ *   PsychicMqttClient host shim
+ *
+ *   FreeRTOS tasks, semaphores, queues, stream buffers and event groups on POSIX threads.
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "freertos/stream_buffer.h"
+#include "freertos/event_groups.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+void vPortEnterCritical(portMUX_TYPE *mux)
+{
+    while (__atomic_exchange_n(&mux->locked, 1, __ATOMIC_ACQUIRE))
+    {
+        while (__atomic_load_n(&mux->locked, __ATOMIC_RELAXED))
+            sched_yield();
+    }
+}
+
+void vPortExitCritical(portMUX_TYPE *mux)
+{
+    __atomic_store_n(&mux->locked, 0, __ATOMIC_RELEASE);
+}
+
+// Waits on a condition variable for the given number of ticks, portMAX_DELAY waits forever
+template <typename Predicate>
+static bool wait_ticks(std::condition_variable &cv, std::unique_lock<std::mutex> &lock, TickType_t ticks,
+                       Predicate predicate)
+{
+    if (ticks == portMAX_DELAY)
+    {
+        cv.wait(lock, predicate);
+        return true;
+    }
+    return cv.wait_for(lock, std::chrono::milliseconds(ticks), predicate);
+}
+
+/*------------------------------------------------------------------------------------------------*/
+// Tasks
+/*------------------------------------------------------------------------------------------------*/
+
+struct host_task
+{
+    TaskFunction_t function;
+    void *parameters;
+    pthread_t thread;
+};
+
+static thread_local host_task *current_task = nullptr;
+
+static void *task_entry(void *arg)
+{
+    host_task *task = (host_task *)arg;
+    current_task = task;
+    task->function(task->parameters);
+    return nullptr;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    usleep((useconds_t)ticks * 1000 * portTICK_PERIOD_MS);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (TickType_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return current_task != nullptr ? (TaskHandle_t)current_task : (TaskHandle_t)pthread_self();
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stackDepth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *createdTask)
+{
+    (void)stackDepth;
+    (void)priority;
+    host_task *task = new host_task{function, parameters, pthread_t()};
+    if (pthread_create(&task->thread, nullptr, task_entry, task) != 0)
+    {
+        delete task;
+        return pdFAIL;
+    }
+    pthread_detach(task->thread);
+    if (name != nullptr)
+    {
+        char threadName[16];
+        strncpy(threadName, name, sizeof(threadName) - 1);
+        threadName[sizeof(threadName) - 1] = '\0';
+        pthread_setname_np(task->thread, threadName);
+    }
+    if (createdTask != nullptr)
+        *createdTask = (TaskHandle_t)task;
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stackDepth, void *parameters,
+                                   UBaseType_t priority, TaskHandle_t *createdTask, BaseType_t core)
+{
+    (void)core;
+    return xTaskCreate(function, name, stackDepth, parameters, priority, createdTask);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    // Only self deletion is supported, as used by tasks returning from their function
+    if (task == nullptr || task == (TaskHandle_t)current_task)
+    {
+        host_task *self = current_task;
+        current_task = nullptr;
+        delete self;
+        pthread_exit(nullptr);
+    }
+}
+
+/*------------------------------------------------------------------------------------------------*/
+// Semaphores
+/*------------------------------------------------------------------------------------------------*/
+
+struct host_semaphore
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    UBaseType_t count;
+    UBaseType_t maxCount;
+    bool recursive;
+    std::thread::id owner;
+    UBaseType_t depth;
+};
+
+static SemaphoreHandle_t semaphore_create(UBaseType_t maxCount, UBaseType_t initialCount, bool recursive)
+{
+    host_semaphore *semaphore = new host_semaphore();
+    semaphore->count = initialCount;
+    semaphore->maxCount = maxCount;
+    semaphore->recursive = recursive;
+    semaphore->depth = 0;
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return semaphore_create(1, 0, false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount)
+{
+    return semaphore_create(maxCount, initialCount, false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return semaphore_create(1, 1, false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void)
+{
+    return semaphore_create(1, 1, true);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticksToWait)
+{
+    std::unique_lock<std::mutex> lock(semaphore->mutex);
+    if (!wait_ticks(semaphore->cv, lock, ticksToWait, [semaphore]
+                    { return semaphore->count > 0; }))
+        return pdFALSE;
+    semaphore->count--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    std::lock_guard<std::mutex> lock(semaphore->mutex);
+    if (semaphore->count >= semaphore->maxCount)
+        return pdFALSE;
+    semaphore->count++;
+    semaphore->cv.notify_one();
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t semaphore, TickType_t ticksToWait)
+{
+    std::unique_lock<std::mutex> lock(semaphore->mutex);
+    std::thread::id self = std::this_thread::get_id();
+    if (semaphore->depth > 0 && semaphore->owner == self)
+    {
+        semaphore->depth++;
+        return pdTRUE;
+    }
+    if (!wait_ticks(semaphore->cv, lock, ticksToWait, [semaphore]
+                    { return semaphore->depth == 0; }))
+        return pdFALSE;
+    semaphore->owner = self;
+    semaphore->depth = 1;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t semaphore)
+{
+    std::lock_guard<std::mutex> lock(semaphore->mutex);
+    if (semaphore->depth == 0 || semaphore->owner != std::this_thread::get_id())
+        return pdFALSE;
+    if (--semaphore->depth == 0)
+        semaphore->cv.notify_one();
+    return pdTRUE;
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t semaphore)
+{
+    std::lock_guard<std::mutex> lock(semaphore->mutex);
+    return semaphore->recursive ? (semaphore->depth == 0 ? 1 : 0) : semaphore->count;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+    delete semaphore;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+// Queues
+/*------------------------------------------------------------------------------------------------*/
+
+struct host_queue
+{
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::deque<std::vector<uint8_t>> items;
+    UBaseType_t length;
+    UBaseType_t itemSize;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+    host_queue *queue = new host_queue();
+    queue->length = length;
+    queue->itemSize = itemSize;
+    return queue;
+}
+
+static BaseType_t queue_send(QueueHandle_t queue, const void *item, TickType_t ticksToWait, bool front)
+{
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!wait_ticks(queue->notFull, lock, ticksToWait, [queue]
+                    { return queue->items.size() < queue->length; }))
+        return pdFALSE;
+    std::vector<uint8_t> copy((const uint8_t *)item, (const uint8_t *)item + queue->itemSize);
+    if (front)
+        queue->items.push_front(std::move(copy));
+    else
+        queue->items.push_back(std::move(copy));
+    queue->notEmpty.notify_one();
+    return pdTRUE;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticksToWait)
+{
+    return queue_send(queue, item, ticksToWait, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticksToWait)
+{
+    return queue_send(queue, item, ticksToWait, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticksToWait)
+{
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!wait_ticks(queue->notEmpty, lock, ticksToWait, [queue]
+                    { return !queue->items.empty(); }))
+        return pdFALSE;
+    memcpy(buffer, queue->items.front().data(), queue->itemSize);
+    queue->items.pop_front();
+    queue->notFull.notify_one();
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    return queue->items.size();
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    return queue->length - queue->items.size();
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    delete queue;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+// Stream buffers
+/*------------------------------------------------------------------------------------------------*/
+
+struct host_stream_buffer
+{
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::vector<uint8_t> data;
+    size_t head;
+    size_t count;
+    size_t triggerLevel;
+};
+
+StreamBufferHandle_t xStreamBufferCreate(size_t bufferSize, size_t triggerLevel)
+{
+    host_stream_buffer *buffer = new host_stream_buffer();
+    buffer->data.resize(bufferSize);
+    buffer->head = 0;
+    buffer->count = 0;
+    buffer->triggerLevel = triggerLevel > 0 ? triggerLevel : 1;
+    return buffer;
+}
+
+// Like FreeRTOS, waits until all data fits and writes as much as possible on timeout
+size_t xStreamBufferSend(StreamBufferHandle_t buffer, const void *data, size_t length, TickType_t ticksToWait)
+{
+    std::unique_lock<std::mutex> lock(buffer->mutex);
+    size_t capacity = buffer->data.size();
+    size_t required = length < capacity ? length : capacity;
+    wait_ticks(buffer->notFull, lock, ticksToWait, [buffer, capacity, required]
+               { return capacity - buffer->count >= required; });
+    size_t space = capacity - buffer->count;
+    size_t written = length < space ? length : space;
+    size_t tail = (buffer->head + buffer->count) % capacity;
+    size_t first = written < capacity - tail ? written : capacity - tail;
+    memcpy(&buffer->data[tail], data, first);
+    memcpy(&buffer->data[0], (const uint8_t *)data + first, written - first);
+    buffer->count += written;
+    if (written > 0)
+        buffer->notEmpty.notify_one();
+    return written;
+}
+
+size_t xStreamBufferReceive(StreamBufferHandle_t buffer, void *data, size_t length, TickType_t ticksToWait)
+{
+    std::unique_lock<std::mutex> lock(buffer->mutex);
+    size_t trigger = length < buffer->triggerLevel ? length : buffer->triggerLevel;
+    if (!wait_ticks(buffer->notEmpty, lock, ticksToWait, [buffer, trigger]
+                    { return buffer->count >= trigger && buffer->count > 0; }) &&
+        buffer->count == 0)
+        return 0;
+    size_t capacity = buffer->data.size();
+    size_t read = length < buffer->count ? length : buffer->count;
+    size_t first = read < capacity - buffer->head ? read : capacity - buffer->head;
+    memcpy(data, &buffer->data[buffer->head], first);
+    memcpy((uint8_t *)data + first, &buffer->data[0], read - first);
+    buffer->head = (buffer->head + read) % capacity;
+    buffer->count -= read;
+    buffer->notFull.notify_one();
+    return read;
+}
+
+size_t xStreamBufferBytesAvailable(StreamBufferHandle_t buffer)
+{
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    return buffer->count;
+}
+
+size_t xStreamBufferSpacesAvailable(StreamBufferHandle_t buffer)
+{
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    return buffer->data.size() - buffer->count;
+}
+
+BaseType_t xStreamBufferReset(StreamBufferHandle_t buffer)
+{
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    buffer->head = 0;
+    buffer->count = 0;
+    buffer->notFull.notify_all();
+    return pdPASS;
+}
+
+void vStreamBufferDelete(StreamBufferHandle_t buffer)
+{
+    delete buffer;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+// Event groups
+/*------------------------------------------------------------------------------------------------*/
+
+struct host_event_group
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    EventBits_t bits;
+};
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    host_event_group *group = new host_event_group();
+    group->bits = 0;
+    return group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    std::lock_guard<std::mutex> lock(group->mutex);
+    group->bits |= bits;
+    group->cv.notify_all();
+    return group->bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    std::lock_guard<std::mutex> lock(group->mutex);
+    EventBits_t previous = group->bits;
+    group->bits &= ~bits;
+    return previous;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    std::lock_guard<std::mutex> lock(group->mutex);
+    return group->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clearOnExit,
+                                BaseType_t waitForAllBits, TickType_t ticksToWait)
+{
+    std::unique_lock<std::mutex> lock(group->mutex);
+    auto satisfied = [group, bits, waitForAllBits]
+    { return waitForAllBits ? (group->bits & bits) == bits : (group->bits & bits) != 0; };
+    bool met = wait_ticks(group->cv, lock, ticksToWait, satisfied);
+    EventBits_t result = group->bits;
+    if (met && clearOnExit)
+        group->bits &= ~bits;
+    return result;
+}
+
+void vEventGroupDelete(EventGroupHandle_t group)
+{
+    delete group;
+}
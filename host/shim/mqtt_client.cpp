@@ -0,0 +1,1154 @@
+/**
+ *   PsychicMqttClient host shim
+ *
+ *   MQTT 3.1.1 client behind the esp_mqtt_client_* API. The client task mirrors
+ *   the esp-mqtt state machine (INIT, CONNECTED, WAIT_RECONNECT, DISCONNECTED),
+ *   holds the API lock while it dispatches events, keeps unacknowledged messages
+ *   in an outbox with retransmission and expiry, and splits received messages
+ *   larger than the buffer into chunked DATA events.
+ */
+
+#include "mqtt_client.h"
+#include "esp_log.h"
+#include "esp_transport_tcp.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const char *TAG = "mqtt_client";
+
+#define MQTT_DEFAULT_BUFFER_SIZE 1024
+#define MQTT_MAX_FIXED_HEADER_SIZE 5
+#define MQTT_DEFAULT_KEEPALIVE 120
+#define MQTT_DEFAULT_NETWORK_TIMEOUT_MS 10000
+#define MQTT_DEFAULT_RECONNECT_TIMEOUT_MS 10000
+#define MQTT_DEFAULT_RETRANSMIT_TIMEOUT_MS 1000
+#define MQTT_OUTBOX_EXPIRED_TIMEOUT_MS (30 * 1000)
+#define MQTT_POLL_READ_TIMEOUT_MS 10
+
+enum mqtt_packet_type
+{
+    MQTT_MSG_TYPE_CONNECT = 1,
+    MQTT_MSG_TYPE_CONNACK = 2,
+    MQTT_MSG_TYPE_PUBLISH = 3,
+    MQTT_MSG_TYPE_PUBACK = 4,
+    MQTT_MSG_TYPE_PUBREC = 5,
+    MQTT_MSG_TYPE_PUBREL = 6,
+    MQTT_MSG_TYPE_PUBCOMP = 7,
+    MQTT_MSG_TYPE_SUBSCRIBE = 8,
+    MQTT_MSG_TYPE_SUBACK = 9,
+    MQTT_MSG_TYPE_UNSUBSCRIBE = 10,
+    MQTT_MSG_TYPE_UNSUBACK = 11,
+    MQTT_MSG_TYPE_PINGREQ = 12,
+    MQTT_MSG_TYPE_PINGRESP = 13,
+    MQTT_MSG_TYPE_DISCONNECT = 14,
+};
+
+enum mqtt_client_state_t
+{
+    MQTT_STATE_INIT,
+    MQTT_STATE_DISCONNECTED,
+    MQTT_STATE_CONNECTED,
+    MQTT_STATE_WAIT_RECONNECT,
+};
+
+enum outbox_pending_t
+{
+    QUEUED,
+    TRANSMITTED,
+    ACKNOWLEDGED, // PUBREC received, PUBREL stored in place of the PUBLISH
+};
+
+typedef struct
+{
+    int msg_id;
+    int type;
+    int qos;
+    std::vector<uint8_t> packet;
+    outbox_pending_t pending;
+    int64_t created;
+    int64_t sent;
+} outbox_item_t;
+
+typedef struct
+{
+    esp_mqtt_event_id_t event;
+    esp_event_handler_t handler;
+    void *arg;
+} event_handler_t;
+
+struct esp_mqtt_client
+{
+    std::recursive_mutex api_lock;
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    std::thread task;
+    std::atomic<bool> run{false};
+    std::thread::id task_id;
+    mqtt_client_state_t state = MQTT_STATE_INIT;
+
+    // Connection settings
+    std::string scheme;
+    std::string host;
+    int port = 0;
+    std::string path;
+    std::string username;
+    std::string password;
+    std::string client_id;
+    std::string lwt_topic;
+    std::string lwt_msg;
+    int lwt_qos = 0;
+    int lwt_retain = 0;
+    bool clean_session = true;
+    int keepalive = MQTT_DEFAULT_KEEPALIVE;
+    int network_timeout_ms = MQTT_DEFAULT_NETWORK_TIMEOUT_MS;
+    int reconnect_timeout_ms = MQTT_DEFAULT_RECONNECT_TIMEOUT_MS;
+    int retransmit_timeout_ms = MQTT_DEFAULT_RETRANSMIT_TIMEOUT_MS;
+    bool auto_reconnect = true;
+    int buffer_size = MQTT_DEFAULT_BUFFER_SIZE;
+    int out_buffer_size = MQTT_DEFAULT_BUFFER_SIZE;
+    uint64_t outbox_limit = 0;
+
+    esp_transport_handle_t transport = nullptr;
+    esp_transport_handle_t own_transport = nullptr;
+
+    std::vector<event_handler_t> handlers;
+    esp_mqtt_event_t event;
+    esp_mqtt_error_codes_t error_handle;
+
+    std::list<outbox_item_t> outbox;
+    uint64_t outbox_size = 0;
+    std::set<int> qos2_received;
+    uint16_t last_msg_id = 0;
+
+    int64_t keepalive_tick = 0; // pings are sent on this tick regardless of other traffic, like esp-mqtt
+    int64_t ping_sent = 0;
+    bool wait_for_ping_resp = false;
+    int64_t reconnect_tick = 0;
+    bool disconnect_requested = false;
+    bool transport_failed = false;
+};
+
+static int64_t tick_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/*------------------------------------------------------------------------------------------------*/
+// Configuration
+/*------------------------------------------------------------------------------------------------*/
+
+static esp_err_t parse_uri(esp_mqtt_client_handle_t client, const char *uri)
+{
+    // The environment override redirects every configured or pinned server to a local broker
+    const char *override = getenv("PSYCHIC_MQTT_BROKER");
+    if (override != nullptr && *override != '\0')
+        uri = override;
+
+    std::string s(uri);
+    size_t schemeEnd = s.find("://");
+    if (schemeEnd == std::string::npos)
+    {
+        ESP_LOGE(TAG, "Invalid URI %s", uri);
+        return ESP_ERR_INVALID_ARG;
+    }
+    client->scheme = s.substr(0, schemeEnd);
+    std::string rest = s.substr(schemeEnd + 3);
+
+    size_t pathStart = rest.find('/');
+    client->path = pathStart == std::string::npos ? "" : rest.substr(pathStart);
+    std::string authority = rest.substr(0, pathStart);
+
+    size_t at = authority.rfind('@');
+    if (at != std::string::npos)
+    {
+        std::string userinfo = authority.substr(0, at);
+        authority = authority.substr(at + 1);
+        size_t colon = userinfo.find(':');
+        client->username = userinfo.substr(0, colon);
+        if (colon != std::string::npos)
+            client->password = userinfo.substr(colon + 1);
+    }
+
+    // IPv6 literals are enclosed in brackets
+    size_t portSep = std::string::npos;
+    if (!authority.empty() && authority[0] == '[')
+    {
+        size_t close = authority.find(']');
+        client->host = authority.substr(1, close - 1);
+        if (close + 1 < authority.size() && authority[close + 1] == ':')
+            portSep = close + 1;
+    }
+    else
+    {
+        portSep = authority.rfind(':');
+        client->host = authority.substr(0, portSep);
+    }
+    client->port = portSep == std::string::npos ? 0 : atoi(authority.c_str() + portSep + 1);
+    if (client->port == 0)
+    {
+        if (client->scheme == "mqtts")
+            client->port = 8883;
+        else if (client->scheme == "ws")
+            client->port = 80;
+        else if (client->scheme == "wss")
+            client->port = 443;
+        else
+            client->port = 1883;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t apply_config(esp_mqtt_client_handle_t client, const esp_mqtt_client_config_t *config)
+{
+    if (config->broker.address.uri != nullptr)
+    {
+        esp_err_t err = parse_uri(client, config->broker.address.uri);
+        if (err != ESP_OK)
+            return err;
+    }
+    else if (config->broker.address.hostname != nullptr)
+    {
+        static const char *schemes[] = {"mqtt", "mqtt", "mqtts", "ws", "wss"};
+        std::string uri = std::string(schemes[config->broker.address.transport]) + "://" +
+                          config->broker.address.hostname + ":" + std::to_string(config->broker.address.port) +
+                          (config->broker.address.path != nullptr ? config->broker.address.path : "");
+        esp_err_t err = parse_uri(client, uri.c_str());
+        if (err != ESP_OK)
+            return err;
+    }
+
+    if (config->credentials.username != nullptr)
+        client->username = config->credentials.username;
+    if (config->credentials.authentication.password != nullptr)
+        client->password = config->credentials.authentication.password;
+    if (config->credentials.set_null_client_id)
+        client->client_id = "";
+    else if (config->credentials.client_id != nullptr)
+        client->client_id = config->credentials.client_id;
+    else if (client->client_id.empty())
+    {
+        char id[32];
+        snprintf(id, sizeof(id), "ESP32_%06X", (unsigned)(getpid() & 0xffffff));
+        client->client_id = id;
+    }
+
+    client->lwt_topic = config->session.last_will.topic != nullptr ? config->session.last_will.topic : "";
+    if (config->session.last_will.msg != nullptr)
+    {
+        int len = config->session.last_will.msg_len > 0 ? config->session.last_will.msg_len
+                                                        : (int)strlen(config->session.last_will.msg);
+        client->lwt_msg.assign(config->session.last_will.msg, len);
+    }
+    else
+        client->lwt_msg.clear();
+    client->lwt_qos = config->session.last_will.qos;
+    client->lwt_retain = config->session.last_will.retain;
+
+    client->clean_session = !config->session.disable_clean_session;
+    if (config->session.disable_keepalive)
+        client->keepalive = 0;
+    else
+        client->keepalive = config->session.keepalive > 0 ? config->session.keepalive : MQTT_DEFAULT_KEEPALIVE;
+    if (config->session.message_retransmit_timeout > 0)
+        client->retransmit_timeout_ms = config->session.message_retransmit_timeout;
+
+    if (config->network.timeout_ms > 0)
+        client->network_timeout_ms = config->network.timeout_ms;
+    if (config->network.reconnect_timeout_ms > 0)
+        client->reconnect_timeout_ms = config->network.reconnect_timeout_ms;
+    client->auto_reconnect = !config->network.disable_auto_reconnect;
+    client->transport = config->network.transport != nullptr ? config->network.transport : client->own_transport;
+
+    if (config->buffer.size > 0)
+        client->buffer_size = config->buffer.size;
+    client->out_buffer_size = config->buffer.out_size > 0 ? config->buffer.out_size : client->buffer_size;
+    client->outbox_limit = config->outbox.limit;
+    return ESP_OK;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+// Events
+/*------------------------------------------------------------------------------------------------*/
+
+static void dispatch_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event_id)
+{
+    client->event.event_id = event_id;
+    client->event.client = client;
+    client->event.error_handle = &client->error_handle;
+    client->event.protocol_ver = MQTT_PROTOCOL_V_3_1_1;
+
+    // Handlers may register further handlers, so iterate over a snapshot
+    std::vector<event_handler_t> handlers = client->handlers;
+    for (const auto &h : handlers)
+    {
+        if (h.event == MQTT_EVENT_ANY || h.event == event_id)
+            h.handler(h.arg, "MQTT_EVENTS", event_id, &client->event);
+    }
+}
+
+static void dispatch_simple(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event_id, int msg_id)
+{
+    memset(&client->event, 0, sizeof(client->event));
+    client->event.msg_id = msg_id;
+    dispatch_event(client, event_id);
+}
+
+/*------------------------------------------------------------------------------------------------*/
+// Packet encoding
+/*------------------------------------------------------------------------------------------------*/
+
+static void put_u16(std::vector<uint8_t> &out, uint16_t value)
+{
+    out.push_back(value >> 8);
+    out.push_back(value & 0xff);
+}
+
+static void put_string(std::vector<uint8_t> &out, const char *data, size_t len)
+{
+    put_u16(out, (uint16_t)len);
+    out.insert(out.end(), (const uint8_t *)data, (const uint8_t *)data + len);
+}
+
+static std::vector<uint8_t> make_packet(uint8_t header, const std::vector<uint8_t> &body)
+{
+    std::vector<uint8_t> packet;
+    packet.reserve(body.size() + 5);
+    packet.push_back(header);
+    size_t remaining = body.size();
+    do
+    {
+        uint8_t byte = remaining % 128;
+        remaining /= 128;
+        if (remaining > 0)
+            byte |= 0x80;
+        packet.push_back(byte);
+    } while (remaining > 0);
+    packet.insert(packet.end(), body.begin(), body.end());
+    return packet;
+}
+
+static std::vector<uint8_t> make_ack(int type, int msg_id)
+{
+    std::vector<uint8_t> body;
+    put_u16(body, msg_id);
+    return make_packet((type << 4) | (type == MQTT_MSG_TYPE_PUBREL ? 0x02 : 0x00), body);
+}
+
+static std::vector<uint8_t> make_connect(esp_mqtt_client_handle_t client)
+{
+    std::vector<uint8_t> body;
+    put_string(body, "MQTT", 4);
+    body.push_back(4); // protocol level 3.1.1
+    uint8_t flags = client->clean_session ? 0x02 : 0x00;
+    if (!client->lwt_topic.empty())
+        flags |= 0x04 | ((client->lwt_qos & 0x03) << 3) | (client->lwt_retain ? 0x20 : 0x00);
+    if (!client->username.empty())
+        flags |= 0x80;
+    if (!client->password.empty())
+        flags |= 0x40;
+    body.push_back(flags);
+    put_u16(body, client->keepalive);
+    put_string(body, client->client_id.data(), client->client_id.size());
+    if (!client->lwt_topic.empty())
+    {
+        put_string(body, client->lwt_topic.data(), client->lwt_topic.size());
+        put_string(body, client->lwt_msg.data(), client->lwt_msg.size());
+    }
+    if (!client->username.empty())
+        put_string(body, client->username.data(), client->username.size());
+    if (!client->password.empty())
+        put_string(body, client->password.data(), client->password.size());
+    return make_packet(MQTT_MSG_TYPE_CONNECT << 4, body);
+}
+
+static int next_msg_id(esp_mqtt_client_handle_t client)
+{
+    // Skip ids still in use by the outbox
+    while (true)
+    {
+        if (++client->last_msg_id == 0)
+            client->last_msg_id = 1;
+        bool used = false;
+        for (const auto &item : client->outbox)
+        {
+            if (item.msg_id == client->last_msg_id)
+            {
+                used = true;
+                break;
+            }
+        }
+        if (!used)
+            return client->last_msg_id;
+    }
+}
+
+/*------------------------------------------------------------------------------------------------*/
+// Transport I/O
+/*------------------------------------------------------------------------------------------------*/
+
+static esp_err_t write_packet(esp_mqtt_client_handle_t client, const std::vector<uint8_t> &packet)
+{
+    size_t written = 0;
+    int64_t deadline = tick_ms() + client->network_timeout_ms;
+    while (written < packet.size())
+    {
+        int remaining = (int)(deadline - tick_ms());
+        if (remaining <= 0)
+        {
+            client->error_handle.esp_transport_sock_errno = ETIMEDOUT;
+            return ESP_ERR_TIMEOUT;
+        }
+        int ret = esp_transport_write(client->transport, (const char *)packet.data() + written,
+                                      (int)(packet.size() - written), remaining);
+        if (ret < 0)
+        {
+            client->error_handle.esp_transport_sock_errno = esp_transport_get_errno(client->transport);
+            return ESP_FAIL;
+        }
+        written += ret;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t read_exact(esp_mqtt_client_handle_t client, uint8_t *buffer, size_t len, int timeout_ms)
+{
+    size_t received = 0;
+    int64_t deadline = tick_ms() + timeout_ms;
+    while (received < len)
+    {
+        int remaining = (int)(deadline - tick_ms());
+        if (remaining <= 0)
+        {
+            client->error_handle.esp_transport_sock_errno = ETIMEDOUT;
+            return ESP_ERR_TIMEOUT;
+        }
+        int ret = esp_transport_read(client->transport, (char *)buffer + received, (int)(len - received), remaining);
+        if (ret < 0)
+        {
+            client->error_handle.esp_transport_sock_errno = esp_transport_get_errno(client->transport);
+            return ESP_FAIL;
+        }
+        received += ret;
+    }
+    return ESP_OK;
+}
+
+// Reads one complete packet, returns its fixed header byte and the variable part in body
+static esp_err_t read_packet(esp_mqtt_client_handle_t client, uint8_t &header, std::vector<uint8_t> &body,
+                             int timeout_ms)
+{
+    esp_err_t err = read_exact(client, &header, 1, timeout_ms);
+    if (err != ESP_OK)
+        return err;
+    size_t remaining = 0;
+    int shift = 0;
+    uint8_t byte;
+    do
+    {
+        err = read_exact(client, &byte, 1, client->network_timeout_ms);
+        if (err != ESP_OK)
+            return err;
+        remaining |= (size_t)(byte & 0x7f) << shift;
+        shift += 7;
+        if (shift > 21 && (byte & 0x80))
+        {
+            client->error_handle.esp_transport_sock_errno = EPROTO;
+            return ESP_FAIL;
+        }
+    } while (byte & 0x80);
+    body.resize(remaining);
+    return remaining == 0 ? ESP_OK : read_exact(client, body.data(), remaining, client->network_timeout_ms);
+}
+
+/*------------------------------------------------------------------------------------------------*/
+// Connection handling
+/*------------------------------------------------------------------------------------------------*/
+
+static void abort_connection(esp_mqtt_client_handle_t client, bool report_error)
+{
+    esp_transport_close(client->transport);
+    client->wait_for_ping_resp = false;
+    client->transport_failed = false;
+    client->qos2_received.clear();
+    if (report_error)
+    {
+        client->error_handle.error_type = MQTT_ERROR_TYPE_TCP_TRANSPORT;
+        memset(&client->event, 0, sizeof(client->event));
+        dispatch_event(client, MQTT_EVENT_ERROR);
+    }
+    client->reconnect_tick = tick_ms();
+    client->state = client->auto_reconnect ? MQTT_STATE_WAIT_RECONNECT : MQTT_STATE_DISCONNECTED;
+    dispatch_simple(client, MQTT_EVENT_DISCONNECTED, 0);
+}
+
+static void connect_to_broker(esp_mqtt_client_handle_t client)
+{
+    memset(&client->error_handle, 0, sizeof(client->error_handle));
+    dispatch_simple(client, MQTT_EVENT_BEFORE_CONNECT, 0);
+    if (!client->run)
+        return;
+
+    if (client->transport == client->own_transport && client->scheme != "mqtt")
+    {
+        ESP_LOGE(TAG, "Transport %s:// is not supported on the host, use mqtt:// or set PSYCHIC_MQTT_BROKER",
+                 client->scheme.c_str());
+        client->error_handle.esp_transport_sock_errno = EPROTONOSUPPORT;
+        abort_connection(client, true);
+        return;
+    }
+
+    ESP_LOGD(TAG, "Connecting to %s:%d", client->host.c_str(), client->port);
+    if (esp_transport_connect(client->transport, client->host.c_str(), client->port, client->network_timeout_ms) < 0)
+    {
+        client->error_handle.esp_transport_sock_errno = esp_transport_get_errno(client->transport);
+        ESP_LOGE(TAG, "Error transport connect");
+        abort_connection(client, true);
+        return;
+    }
+
+    uint8_t header = 0;
+    std::vector<uint8_t> body;
+    if (write_packet(client, make_connect(client)) != ESP_OK ||
+        read_packet(client, header, body, client->network_timeout_ms) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error sending or receiving connect message");
+        abort_connection(client, true);
+        return;
+    }
+    if ((header >> 4) != MQTT_MSG_TYPE_CONNACK || body.size() < 2)
+    {
+        ESP_LOGE(TAG, "Invalid CONNACK");
+        client->error_handle.esp_transport_sock_errno = EPROTO;
+        abort_connection(client, true);
+        return;
+    }
+    if (body[1] != MQTT_CONNECTION_ACCEPTED)
+    {
+        ESP_LOGE(TAG, "Connection refused, reason code=0x%02x", body[1]);
+        client->error_handle.error_type = MQTT_ERROR_TYPE_CONNECTION_REFUSED;
+        client->error_handle.connect_return_code = (esp_mqtt_connect_return_code_t)body[1];
+        memset(&client->event, 0, sizeof(client->event));
+        dispatch_event(client, MQTT_EVENT_ERROR);
+        abort_connection(client, false);
+        return;
+    }
+
+    // Everything not yet acknowledged is sent again on the new connection
+    for (auto &item : client->outbox)
+    {
+        if (item.pending == TRANSMITTED)
+            item.pending = QUEUED;
+    }
+    client->state = MQTT_STATE_CONNECTED;
+    client->wait_for_ping_resp = false;
+    client->keepalive_tick = tick_ms();
+    client->disconnect_requested = false;
+    memset(&client->event, 0, sizeof(client->event));
+    client->event.session_present = body[0] & 0x01;
+    dispatch_event(client, MQTT_EVENT_CONNECTED);
+}
+
+/*------------------------------------------------------------------------------------------------*/
+// Outbox
+/*------------------------------------------------------------------------------------------------*/
+
+static outbox_item_t *outbox_enqueue(esp_mqtt_client_handle_t client, int msg_id, int type, int qos,
+                                     std::vector<uint8_t> packet)
+{
+    client->outbox_size += packet.size();
+    int64_t now = tick_ms();
+    client->outbox.push_back({msg_id, type, qos, std::move(packet), QUEUED, now, 0});
+    return &client->outbox.back();
+}
+
+static std::list<outbox_item_t>::iterator outbox_find(esp_mqtt_client_handle_t client, int msg_id, int type)
+{
+    for (auto it = client->outbox.begin(); it != client->outbox.end(); ++it)
+    {
+        if (it->msg_id == msg_id && it->type == type)
+            return it;
+    }
+    return client->outbox.end();
+}
+
+static void outbox_delete(esp_mqtt_client_handle_t client, std::list<outbox_item_t>::iterator it)
+{
+    client->outbox_size -= it->packet.size();
+    client->outbox.erase(it);
+}
+
+static esp_err_t outbox_send(esp_mqtt_client_handle_t client, outbox_item_t &item)
+{
+    esp_err_t err = write_packet(client, item.packet);
+    if (err != ESP_OK)
+        return err;
+    item.sent = tick_ms();
+    if (item.qos == 0)
+        item.pending = ACKNOWLEDGED; // nothing to wait for, removed by the caller
+    else if (item.pending == QUEUED)
+        item.pending = TRANSMITTED;
+    if (item.type == MQTT_MSG_TYPE_PUBLISH)
+        item.packet[0] |= 0x08; // further transmissions are duplicates
+    return ESP_OK;
+}
+
+static esp_err_t process_outbox(esp_mqtt_client_handle_t client)
+{
+    int64_t now = tick_ms();
+    for (auto it = client->outbox.begin(); it != client->outbox.end();)
+    {
+        if (now - it->created > MQTT_OUTBOX_EXPIRED_TIMEOUT_MS)
+        {
+            int msg_id = it->msg_id;
+            outbox_delete(client, it++);
+            ESP_LOGD(TAG, "Deleted expired msg_id=%d", msg_id);
+            dispatch_simple(client, MQTT_EVENT_DELETED, msg_id);
+            continue;
+        }
+        if (it->pending == QUEUED || (it->qos > 0 && now - it->sent > client->retransmit_timeout_ms))
+        {
+            esp_err_t err = outbox_send(client, *it);
+            if (err != ESP_OK)
+                return err;
+            if (it->qos == 0)
+            {
+                outbox_delete(client, it++);
+                continue;
+            }
+        }
+        ++it;
+    }
+    return ESP_OK;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+// Incoming packets
+/*------------------------------------------------------------------------------------------------*/
+
+static esp_err_t deliver_publish(esp_mqtt_client_handle_t client, uint8_t header, std::vector<uint8_t> &body)
+{
+    int qos = (header >> 1) & 0x03;
+    if (body.size() < 2)
+        return ESP_FAIL;
+    size_t topic_len = (body[0] << 8) | body[1];
+    size_t offset = 2 + topic_len;
+    int msg_id = 0;
+    if (qos > 0)
+    {
+        if (body.size() < offset + 2)
+            return ESP_FAIL;
+        msg_id = (body[offset] << 8) | body[offset + 1];
+        offset += 2;
+    }
+    if (body.size() < offset)
+        return ESP_FAIL;
+
+    // A QoS 2 message is delivered once, duplicates before PUBREL are only acknowledged
+    bool deliver = qos < 2 || client->qos2_received.insert(msg_id).second;
+    if (deliver)
+    {
+        int total = (int)(body.size() - offset);
+        int header_len = 1 + (body.size() < 128 ? 1 : body.size() < 16384 ? 2 : body.size() < 2097152 ? 3 : 4);
+        int first = client->buffer_size - header_len - (int)offset;
+        if (first <= 0)
+            first = std::min(total, client->buffer_size);
+
+        int data_offset = 0;
+        do
+        {
+            int len = std::min(total - data_offset, data_offset == 0 ? first : client->buffer_size);
+            memset(&client->event, 0, sizeof(client->event));
+            client->event.msg_id = msg_id;
+            client->event.qos = qos;
+            client->event.retain = header & 0x01;
+            client->event.dup = (header & 0x08) != 0;
+            client->event.topic = data_offset == 0 ? (char *)body.data() + 2 : nullptr;
+            client->event.topic_len = data_offset == 0 ? (int)topic_len : 0;
+            client->event.data = (char *)body.data() + offset + data_offset;
+            client->event.data_len = len;
+            client->event.total_data_len = total;
+            client->event.current_data_offset = data_offset;
+            dispatch_event(client, MQTT_EVENT_DATA);
+            data_offset += len;
+        } while (data_offset < total);
+    }
+
+    if (qos == 1)
+        return write_packet(client, make_ack(MQTT_MSG_TYPE_PUBACK, msg_id));
+    if (qos == 2)
+        return write_packet(client, make_ack(MQTT_MSG_TYPE_PUBREC, msg_id));
+    return ESP_OK;
+}
+
+static esp_err_t handle_packet(esp_mqtt_client_handle_t client, uint8_t header, std::vector<uint8_t> &body)
+{
+    int type = header >> 4;
+    int msg_id = body.size() >= 2 ? (body[0] << 8) | body[1] : 0;
+    switch (type)
+    {
+    case MQTT_MSG_TYPE_PUBLISH:
+        return deliver_publish(client, header, body);
+    case MQTT_MSG_TYPE_PUBACK:
+    {
+        auto it = outbox_find(client, msg_id, MQTT_MSG_TYPE_PUBLISH);
+        if (it != client->outbox.end())
+        {
+            outbox_delete(client, it);
+            dispatch_simple(client, MQTT_EVENT_PUBLISHED, msg_id);
+        }
+        return ESP_OK;
+    }
+    case MQTT_MSG_TYPE_PUBREC:
+    {
+        // Replace the stored PUBLISH with the PUBREL so only the release is retransmitted
+        auto it = outbox_find(client, msg_id, MQTT_MSG_TYPE_PUBLISH);
+        if (it != client->outbox.end())
+        {
+            client->outbox_size -= it->packet.size();
+            it->packet = make_ack(MQTT_MSG_TYPE_PUBREL, msg_id);
+            client->outbox_size += it->packet.size();
+            it->type = MQTT_MSG_TYPE_PUBREL;
+            it->pending = ACKNOWLEDGED;
+            it->sent = tick_ms();
+        }
+        return write_packet(client, make_ack(MQTT_MSG_TYPE_PUBREL, msg_id));
+    }
+    case MQTT_MSG_TYPE_PUBREL:
+        client->qos2_received.erase(msg_id);
+        return write_packet(client, make_ack(MQTT_MSG_TYPE_PUBCOMP, msg_id));
+    case MQTT_MSG_TYPE_PUBCOMP:
+    {
+        auto it = outbox_find(client, msg_id, MQTT_MSG_TYPE_PUBREL);
+        if (it != client->outbox.end())
+        {
+            outbox_delete(client, it);
+            dispatch_simple(client, MQTT_EVENT_PUBLISHED, msg_id);
+        }
+        return ESP_OK;
+    }
+    case MQTT_MSG_TYPE_SUBACK:
+    case MQTT_MSG_TYPE_UNSUBACK:
+    {
+        bool subscribe = type == MQTT_MSG_TYPE_SUBACK;
+        auto it = outbox_find(client, msg_id, subscribe ? MQTT_MSG_TYPE_SUBSCRIBE : MQTT_MSG_TYPE_UNSUBSCRIBE);
+        if (it != client->outbox.end())
+        {
+            outbox_delete(client, it);
+            memset(&client->event, 0, sizeof(client->event));
+            client->event.msg_id = msg_id;
+            // The SUBACK return codes are passed as data, like esp-mqtt does
+            client->event.data = (char *)body.data() + 2;
+            client->event.data_len = (int)body.size() - 2;
+            client->event.total_data_len = client->event.data_len;
+            dispatch_event(client, subscribe ? MQTT_EVENT_SUBSCRIBED : MQTT_EVENT_UNSUBSCRIBED);
+        }
+        return ESP_OK;
+    }
+    case MQTT_MSG_TYPE_PINGRESP:
+        client->wait_for_ping_resp = false;
+        return ESP_OK;
+    default:
+        ESP_LOGW(TAG, "Unexpected packet type %d", type);
+        return ESP_OK;
+    }
+}
+
+/*------------------------------------------------------------------------------------------------*/
+// Client task
+/*------------------------------------------------------------------------------------------------*/
+
+static void wait_wakeup(esp_mqtt_client_handle_t client, int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(client->wake_mutex);
+    client->wake.wait_for(lock, std::chrono::milliseconds(timeout_ms));
+}
+
+static void wake_task(esp_mqtt_client_handle_t client)
+{
+    std::lock_guard<std::mutex> lock(client->wake_mutex);
+    client->wake.notify_all();
+}
+
+static void handle_connected(esp_mqtt_client_handle_t client)
+{
+    if (client->disconnect_requested)
+    {
+        client->disconnect_requested = false;
+        std::vector<uint8_t> body;
+        write_packet(client, make_packet(MQTT_MSG_TYPE_DISCONNECT << 4, body));
+        esp_transport_close(client->transport);
+        client->state = MQTT_STATE_DISCONNECTED;
+        dispatch_simple(client, MQTT_EVENT_DISCONNECTED, 0);
+        return;
+    }
+    if (client->transport_failed || process_outbox(client) != ESP_OK)
+    {
+        abort_connection(client, true);
+        return;
+    }
+
+    if (client->keepalive > 0)
+    {
+        int64_t now = tick_ms();
+        if (client->wait_for_ping_resp && now - client->ping_sent > client->keepalive * 1000)
+        {
+            // esp-mqtt aborts without an error event, only the DISCONNECTED event follows
+            ESP_LOGE(TAG, "No PING_RESP, disconnected");
+            abort_connection(client, false);
+            return;
+        }
+        if (!client->wait_for_ping_resp && now - client->keepalive_tick > client->keepalive * 1000 / 2)
+        {
+            std::vector<uint8_t> body;
+            if (write_packet(client, make_packet(MQTT_MSG_TYPE_PINGREQ << 4, body)) != ESP_OK)
+            {
+                abort_connection(client, true);
+                return;
+            }
+            client->wait_for_ping_resp = true;
+            client->ping_sent = now;
+            client->keepalive_tick = now;
+        }
+    }
+}
+
+static void mqtt_task(esp_mqtt_client_handle_t client)
+{
+    client->task_id = std::this_thread::get_id();
+    while (client->run)
+    {
+        mqtt_client_state_t state;
+        {
+            std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+            switch (client->state)
+            {
+            case MQTT_STATE_INIT:
+                connect_to_broker(client);
+                break;
+            case MQTT_STATE_CONNECTED:
+                handle_connected(client);
+                break;
+            case MQTT_STATE_WAIT_RECONNECT:
+                if (tick_ms() - client->reconnect_tick >= client->reconnect_timeout_ms)
+                    client->state = MQTT_STATE_INIT;
+                break;
+            case MQTT_STATE_DISCONNECTED:
+                break;
+            }
+            state = client->state;
+        }
+        if (!client->run)
+            break;
+
+        if (state != MQTT_STATE_CONNECTED)
+        {
+            if (state != MQTT_STATE_INIT)
+                wait_wakeup(client, MQTT_POLL_READ_TIMEOUT_MS * 10);
+            continue;
+        }
+
+        // Poll without the lock so publishers are not blocked while the connection is idle
+        int ready = esp_transport_poll_read(client->transport, MQTT_POLL_READ_TIMEOUT_MS);
+        std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+        if (!client->run || client->state != MQTT_STATE_CONNECTED)
+            continue;
+        if (ready < 0)
+        {
+            client->error_handle.esp_transport_sock_errno = esp_transport_get_errno(client->transport);
+            abort_connection(client, true);
+            continue;
+        }
+        if (ready == 0)
+            continue;
+        uint8_t header;
+        std::vector<uint8_t> body;
+        if (read_packet(client, header, body, client->network_timeout_ms) != ESP_OK ||
+            handle_packet(client, header, body) != ESP_OK)
+        {
+            abort_connection(client, true);
+        }
+    }
+}
+
+/*------------------------------------------------------------------------------------------------*/
+// API
+/*------------------------------------------------------------------------------------------------*/
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config)
+{
+    esp_mqtt_client_handle_t client = new esp_mqtt_client();
+    client->own_transport = esp_transport_tcp_init();
+    client->transport = client->own_transport;
+    memset(&client->event, 0, sizeof(client->event));
+    memset(&client->error_handle, 0, sizeof(client->error_handle));
+    if (apply_config(client, config) != ESP_OK)
+    {
+        esp_transport_destroy(client->own_transport);
+        delete client;
+        return nullptr;
+    }
+    return client;
+}
+
+esp_err_t esp_mqtt_set_config(esp_mqtt_client_handle_t client, const esp_mqtt_client_config_t *config)
+{
+    if (client == nullptr || config == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+    return apply_config(client, config);
+}
+
+esp_err_t esp_mqtt_client_set_uri(esp_mqtt_client_handle_t client, const char *uri)
+{
+    if (client == nullptr || uri == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+    return parse_uri(client, uri);
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+    if (client == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+    if (client->run)
+    {
+        ESP_LOGE(TAG, "Client has started");
+        return ESP_FAIL;
+    }
+    if (client->task.joinable())
+        client->task.join();
+    client->state = MQTT_STATE_INIT;
+    client->run = true;
+    client->task = std::thread(mqtt_task, client);
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_reconnect(esp_mqtt_client_handle_t client)
+{
+    if (client == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+    if (client->state != MQTT_STATE_WAIT_RECONNECT && client->state != MQTT_STATE_DISCONNECTED)
+        return ESP_FAIL;
+    client->state = MQTT_STATE_INIT;
+    wake_task(client);
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_disconnect(esp_mqtt_client_handle_t client)
+{
+    if (client == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+    if (client->state != MQTT_STATE_CONNECTED)
+        return ESP_FAIL;
+    client->disconnect_requested = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client)
+{
+    if (client == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    {
+        std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+        if (!client->run)
+        {
+            ESP_LOGW(TAG, "Client asked to stop, but was not started");
+            return ESP_FAIL;
+        }
+        if (std::this_thread::get_id() == client->task_id)
+        {
+            ESP_LOGE(TAG, "Client cannot be stopped from MQTT task");
+            return ESP_FAIL;
+        }
+        client->run = false;
+    }
+    wake_task(client);
+    client->task.join();
+
+    std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+    if (client->state == MQTT_STATE_CONNECTED)
+    {
+        std::vector<uint8_t> body;
+        write_packet(client, make_packet(MQTT_MSG_TYPE_DISCONNECT << 4, body));
+    }
+    esp_transport_close(client->transport);
+    client->state = MQTT_STATE_DISCONNECTED;
+    return ESP_OK;
+}
+
+static int publish_message(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos,
+                           int retain, bool send_now, bool store)
+{
+    if (client == nullptr || topic == nullptr)
+        return -1;
+    if (len <= 0 && data != nullptr)
+        len = (int)strlen(data);
+    qos = qos < 0 ? 0 : qos > 2 ? 2 : qos;
+
+    std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+    bool connected = client->state == MQTT_STATE_CONNECTED;
+    if (send_now && !connected && qos == 0)
+    {
+        ESP_LOGD(TAG, "Publishing skipped: client is not connected");
+        return -1;
+    }
+
+    int msg_id = qos > 0 ? next_msg_id(client) : 0;
+    std::vector<uint8_t> body;
+    body.reserve(strlen(topic) + len + 4);
+    put_string(body, topic, strlen(topic));
+    if (qos > 0)
+        put_u16(body, msg_id);
+    if (len > 0)
+        body.insert(body.end(), (const uint8_t *)data, (const uint8_t *)data + len);
+    std::vector<uint8_t> packet = make_packet((MQTT_MSG_TYPE_PUBLISH << 4) | (qos << 1) | (retain ? 1 : 0), body);
+
+    // Like esp-mqtt, a blocking publish beyond the out buffer is sent in fragments and not kept
+    // in the outbox. It is not retransmitted and its acknowledgement raises no event.
+    bool fragmented = send_now && MQTT_MAX_FIXED_HEADER_SIZE + (int)body.size() > client->out_buffer_size;
+    if (fragmented && !connected)
+        return qos > 0 ? msg_id : -1;
+
+    if ((qos > 0 || store) && !fragmented)
+    {
+        if (client->outbox_limit > 0 && client->outbox_size + packet.size() > client->outbox_limit)
+            return -2;
+        outbox_item_t *item = outbox_enqueue(client, msg_id, MQTT_MSG_TYPE_PUBLISH, qos, std::move(packet));
+        if (!send_now || !connected)
+            return msg_id;
+        if (outbox_send(client, *item) != ESP_OK)
+        {
+            client->transport_failed = true;
+            return -1;
+        }
+        if (qos == 0)
+            outbox_delete(client, outbox_find(client, msg_id, MQTT_MSG_TYPE_PUBLISH));
+        return msg_id;
+    }
+
+    if (write_packet(client, packet) != ESP_OK)
+    {
+        client->transport_failed = true;
+        return -1;
+    }
+    return msg_id;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos,
+                            int retain)
+{
+    return publish_message(client, topic, data, len, qos, retain, true, false);
+}
+
+int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos,
+                            int retain, bool store)
+{
+    if (qos == 0 && !store)
+        return esp_mqtt_client_publish(client, topic, data, len, qos, retain);
+    return publish_message(client, topic, data, len, qos, retain, false, true);
+}
+
+static int subscribe_message(esp_mqtt_client_handle_t client, const char *topic, int qos, bool subscribe)
+{
+    if (client == nullptr || topic == nullptr)
+        return -1;
+    std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+    if (client->state != MQTT_STATE_CONNECTED)
+    {
+        ESP_LOGE(TAG, "Client has not connected");
+        return -1;
+    }
+    int msg_id = next_msg_id(client);
+    std::vector<uint8_t> body;
+    put_u16(body, msg_id);
+    put_string(body, topic, strlen(topic));
+    if (subscribe)
+        body.push_back(qos & 0x03);
+    int type = subscribe ? MQTT_MSG_TYPE_SUBSCRIBE : MQTT_MSG_TYPE_UNSUBSCRIBE;
+    outbox_item_t *item = outbox_enqueue(client, msg_id, type, 1, make_packet((type << 4) | 0x02, body));
+    if (outbox_send(client, *item) != ESP_OK)
+    {
+        client->transport_failed = true;
+        return -1;
+    }
+    return msg_id;
+}
+
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos)
+{
+    return subscribe_message(client, topic, qos, true);
+}
+
+int esp_mqtt_client_unsubscribe(esp_mqtt_client_handle_t client, const char *topic)
+{
+    return subscribe_message(client, topic, 0, false);
+}
+
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client)
+{
+    if (client == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    if (client->run)
+        esp_mqtt_client_stop(client);
+    if (client->task.joinable())
+        client->task.join();
+    // Like esp-mqtt, a custom transport from network.transport is destroyed together with the client
+    if (client->transport != client->own_transport)
+        esp_transport_destroy(client->transport);
+    esp_transport_destroy(client->own_transport);
+    delete client;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+                                         esp_event_handler_t event_handler, void *event_handler_arg)
+{
+    if (client == nullptr || event_handler == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+    client->handlers.push_back({event, event_handler, event_handler_arg});
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_unregister_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+                                           esp_event_handler_t event_handler)
+{
+    if (client == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+    for (auto it = client->handlers.begin(); it != client->handlers.end(); ++it)
+    {
+        if (it->event == event && it->handler == event_handler)
+        {
+            client->handlers.erase(it);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+int esp_mqtt_client_get_outbox_size(esp_mqtt_client_handle_t client)
+{
+    if (client == nullptr)
+        return 0;
+    std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+    return (int)client->outbox_size;
+}
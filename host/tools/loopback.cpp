@@ -0,0 +1,371 @@
+/**
+ *   PsychicMqttClient host tools
+ *
+ *   Measures the overhead of the client without a network. The client runs over
+ *   a custom transport, either the in-memory PsychicMqttLoopback or a POSIX
+ *   socket pair with PsychicMqttFdTransport, to a minimal broker in a thread of
+ *   the same process. The broker acknowledges everything and echoes every
+ *   publish back at QoS 0 or 1.
+ *
+ *   loopback [--transport loopback|socketpair] [--messages N]
+ *
+ *   Prints one JSON line per scenario in the format of the Benchmark example,
+ *   extended by the transport, so scripts/compare_benchmark.py can compare two runs.
+ */
+
+#include <Arduino.h>
+#include <PsychicMqttClient.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#define LOOPBACK_WINDOW 8
+#define LOOPBACK_TIMEOUT_MS 5000
+
+/*------------------------------------------------------------------------------------------------*/
+// Minimal broker
+/*------------------------------------------------------------------------------------------------*/
+
+class EchoBroker
+{
+public:
+    typedef std::function<bool(int timeoutMs)> AcceptFunction;
+    typedef std::function<int(uint8_t *buffer, size_t length, int timeoutMs)> ReadFunction;
+    typedef std::function<int(const uint8_t *data, size_t length)> WriteFunction; // must not block
+
+    EchoBroker(AcceptFunction accept, ReadFunction read, WriteFunction write)
+        : _accept(accept), _read(read), _write(write)
+    {
+        _running = true;
+        _thread = std::thread(&EchoBroker::run, this);
+    }
+
+    ~EchoBroker()
+    {
+        _running = false;
+        _thread.join();
+    }
+
+private:
+    AcceptFunction _accept;
+    ReadFunction _read;
+    WriteFunction _write;
+    std::atomic<bool> _running;
+    std::thread _thread;
+    uint16_t _msgId = 0;
+    std::vector<uint8_t> _output; // like a real broker, never block on a client that is not reading
+
+    void send(uint8_t header, const std::vector<uint8_t> &body)
+    {
+        _output.push_back(header);
+        size_t length = body.size();
+        do
+        {
+            uint8_t byte = length % 128;
+            length /= 128;
+            _output.push_back(length > 0 ? byte | 0x80 : byte);
+        } while (length > 0);
+        _output.insert(_output.end(), body.begin(), body.end());
+    }
+
+    bool flush()
+    {
+        if (_output.empty())
+            return true;
+        int written = _write(_output.data(), _output.size());
+        if (written < 0)
+            return false;
+        _output.erase(_output.begin(), _output.begin() + written);
+        return true;
+    }
+
+    void ack(uint8_t header, const uint8_t *msgId)
+    {
+        send(header, {msgId[0], msgId[1]});
+    }
+
+    // Handles one packet, returns false on DISCONNECT
+    bool handle(uint8_t header, const uint8_t *body, size_t length)
+    {
+        switch (header >> 4)
+        {
+        case 1: // CONNECT
+            send(0x20, {0, 0});
+            break;
+        case 3: // PUBLISH
+        {
+            int qos = (header >> 1) & 0x03;
+            size_t topicLength = (body[0] << 8) | body[1];
+            size_t payloadStart = 2 + topicLength + (qos > 0 ? 2 : 0);
+            if (qos == 1)
+                ack(0x40, body + 2 + topicLength);
+            else if (qos == 2)
+                ack(0x50, body + 2 + topicLength);
+
+            int echoQos = qos > 0 ? 1 : 0;
+            std::vector<uint8_t> echo(body, body + 2 + topicLength);
+            if (echoQos > 0)
+            {
+                _msgId = _msgId == 0xffff ? 1 : _msgId + 1;
+                echo.push_back(_msgId >> 8);
+                echo.push_back(_msgId & 0xff);
+            }
+            echo.insert(echo.end(), body + payloadStart, body + length);
+            send(0x30 | (echoQos << 1), echo);
+            break;
+        }
+        case 6: // PUBREL
+            ack(0x70, body);
+            break;
+        case 8: // SUBSCRIBE, granted QoS is capped at 1
+        {
+            std::vector<uint8_t> suback = {body[0], body[1]};
+            for (size_t i = 2; i + 2 < length;)
+            {
+                size_t filterLength = (body[i] << 8) | body[i + 1];
+                i += 2 + filterLength;
+                suback.push_back(std::min<uint8_t>(body[i], 1));
+                i++;
+            }
+            send(0x90, suback);
+            break;
+        }
+        case 10: // UNSUBSCRIBE
+            ack(0xb0, body);
+            break;
+        case 12: // PINGREQ
+            send(0xd0, {});
+            break;
+        case 14: // DISCONNECT
+            return false;
+        default: // PUBACK, PUBREC, PUBCOMP of the echoes
+            break;
+        }
+        return true;
+    }
+
+    void run()
+    {
+        std::vector<uint8_t> buffer;
+        uint8_t chunk[4096];
+        while (_running)
+        {
+            if (!_accept(50))
+                continue;
+            buffer.clear();
+            _output.clear();
+            bool open = true;
+            while (_running && open)
+            {
+                if (!flush())
+                    break;
+                int received = _read(chunk, sizeof(chunk), _output.empty() ? 50 : 1);
+                if (received < 0)
+                    break;
+                buffer.insert(buffer.end(), chunk, chunk + received);
+
+                // Handle all complete packets
+                size_t offset = 0;
+                while (open && buffer.size() - offset >= 2)
+                {
+                    size_t length = 0, shift = 0, position = offset + 1;
+                    bool complete = false;
+                    while (position < buffer.size() && position < offset + 5)
+                    {
+                        uint8_t byte = buffer[position++];
+                        length |= (size_t)(byte & 0x7f) << shift;
+                        shift += 7;
+                        if ((byte & 0x80) == 0)
+                        {
+                            complete = true;
+                            break;
+                        }
+                    }
+                    if (!complete || buffer.size() - position < length)
+                        break;
+                    open = handle(buffer[offset], buffer.data() + position, length);
+                    offset = position + length;
+                }
+                buffer.erase(buffer.begin(), buffer.begin() + offset);
+            }
+        }
+    }
+};
+
+/*------------------------------------------------------------------------------------------------*/
+// Benchmark
+/*------------------------------------------------------------------------------------------------*/
+
+typedef struct
+{
+    int qos;
+    size_t payloadSize;
+} LoopbackScenario_t;
+
+const LoopbackScenario_t scenarios[] = {
+    {0, 16}, {0, 256}, {0, 1024}, {0, 4096}, {1, 16}, {1, 256}, {1, 1024}, {1, 4096}, {2, 16}, {2, 256},
+};
+
+std::atomic<int> received(0);
+std::vector<int64_t> sentAt;
+std::vector<uint32_t> echoLatency;
+
+void onEcho(const char *topic, const char *payload, int retain, int qos, bool dup)
+{
+    int64_t now = esp_timer_get_time();
+    char seqHex[9] = {0};
+    strncpy(seqHex, payload, 8);
+    size_t seq = strtoul(seqHex, nullptr, 16);
+    if (seq < sentAt.size())
+    {
+        int index = received.load();
+        echoLatency[index] = (uint32_t)(now - sentAt[seq]);
+        received.store(index + 1);
+    }
+}
+
+bool waitUntil(std::function<bool()> condition, uint32_t timeoutMs)
+{
+    uint32_t start = millis();
+    while (!condition())
+    {
+        if (millis() - start > timeoutMs)
+            return false;
+        yield();
+    }
+    return true;
+}
+
+void runScenario(PsychicMqttClient &mqttClient, const char *transport, const LoopbackScenario_t &scenario, int messages)
+{
+    std::vector<char> payload(scenario.payloadSize, 'x');
+    payload.push_back('\0');
+    sentAt.assign(messages, 0);
+    echoLatency.assign(messages, 0);
+    received = 0;
+
+    int sent = 0;
+    int64_t start = esp_timer_get_time();
+    for (int seq = 0; seq < messages; seq++)
+    {
+        if (!waitUntil([&]()
+                       { return seq - received.load() < LOOPBACK_WINDOW; },
+                       LOOPBACK_TIMEOUT_MS))
+            break;
+        char seqHex[9];
+        snprintf(seqHex, sizeof(seqHex), "%08x", seq);
+        memcpy(payload.data(), seqHex, std::min<size_t>(8, scenario.payloadSize));
+        sentAt[seq] = esp_timer_get_time();
+        if (mqttClient.publish("bench/loopback", scenario.qos, false, payload.data(), scenario.payloadSize, false) >=
+            0)
+            sent++;
+    }
+    waitUntil([&]()
+              { return received.load() >= sent; },
+              LOOPBACK_TIMEOUT_MS);
+    double seconds = (esp_timer_get_time() - start) / 1000000.0;
+
+    int count = received.load();
+    std::sort(echoLatency.begin(), echoLatency.begin() + count);
+    printf("{\"bench\":\"psychic-mqtt\",\"transport\":\"%s\",\"qos\":%d,\"payload\":%u,\"filters\":1,\"async\":false,"
+           "\"messages\":%d,\"sent\":%d,\"received\":%d,\"seconds\":%.3f,\"msgsPerSec\":%.1f,\"bytesPerSec\":%.1f,"
+           "\"echoUs\":",
+           transport, scenario.qos, (unsigned)scenario.payloadSize, messages, sent, count, seconds, count / seconds,
+           count * scenario.payloadSize / seconds);
+    if (count == 0)
+        printf("null}\n");
+    else
+        printf("{\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u}}\n", echoLatency[count * 50 / 100],
+               echoLatency[count * 90 / 100], echoLatency[count * 99 / 100], echoLatency[count - 1]);
+    fflush(stdout);
+}
+
+void runTransport(const char *transport, esp_transport_handle_t handle, int messages)
+{
+    // The client destroys the transport handle, so it must not outlive the transport object
+    PsychicMqttClient mqttClient;
+    mqttClient.setServer("mqtt://loopback");
+    mqttClient.setTransport(handle);
+    mqttClient.onTopic("bench/loopback", 1, onEcho);
+    mqttClient.connect();
+    if (!mqttClient.waitFor(PSYCHIC_MQTT_STATE_CONNECTED, LOOPBACK_TIMEOUT_MS))
+    {
+        fprintf(stderr, "%s: no connection\n", transport);
+        return;
+    }
+    for (const auto &scenario : scenarios)
+        runScenario(mqttClient, transport, scenario, messages);
+    mqttClient.disconnect();
+}
+
+int main(int argc, char **argv)
+{
+    const char *transport = nullptr;
+    int messages = 5000;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--transport") == 0 && i + 1 < argc)
+            transport = argv[++i];
+        else if (strcmp(argv[i], "--messages") == 0 && i + 1 < argc)
+            messages = atoi(argv[++i]);
+        else
+        {
+            fprintf(stderr, "usage: loopback [--transport loopback|socketpair] [--messages N]\n");
+            return 2;
+        }
+    }
+
+
+    if (transport == nullptr || strcmp(transport, "loopback") == 0)
+    {
+        PsychicMqttLoopback loopback(16384);
+        EchoBroker broker([&](int timeoutMs)
+                          { return loopback.accept(timeoutMs); },
+                          [&](uint8_t *buffer, size_t length, int timeoutMs)
+                          { return loopback.read(buffer, length, timeoutMs); },
+                          [&](const uint8_t *data, size_t length)
+                          { return loopback.write(data, length, 0); });
+        runTransport("loopback", loopback.transport(), messages);
+    }
+
+    if (transport == nullptr || strcmp(transport, "socketpair") == 0)
+    {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        {
+            perror("socketpair");
+            return 1;
+        }
+        PsychicMqttFdTransport fdTransport(fds[0]);
+        std::atomic<bool> accepted(false);
+        EchoBroker broker([&](int timeoutMs)
+                          { return !accepted.exchange(true); },
+                          [&](uint8_t *buffer, size_t length, int timeoutMs)
+                          {
+                              pollfd pfd = {fds[1], POLLIN, 0};
+                              if (poll(&pfd, 1, timeoutMs) <= 0)
+                                  return 0;
+                              int received = ::read(fds[1], buffer, length);
+                              return received > 0 ? received : -1; },
+                          [&](const uint8_t *data, size_t length)
+                          {
+                              int written = send(fds[1], data, length, MSG_DONTWAIT);
+                              return written >= 0 || errno != EAGAIN ? written : 0; });
+        runTransport("socketpair", fdTransport.transport(), messages);
+        close(fds[0]);
+        close(fds[1]);
+    }
+    return 0;
+}
+
+// The shim's Arduino.h declares the sketch functions, this tool has its own main()
+void setup() {}
+void loop() {}
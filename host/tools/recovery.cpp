@@ -0,0 +1,670 @@
+/**
+ *   PsychicMqttClient host tools
+ *
+ *   Recovery benchmark. A fault-injecting TCP proxy sits between the client and
+ *   a local broker. For each scenario the client subscribes to a set of onTopic
+ *   filters and publishes a steady stream of numbered QoS 1 messages to them,
+ *   which the broker echoes back. Then the proxy injects a fault: connections
+ *   reset or refused, half-open sockets silently swallowing all traffic, a slow
+ *   broker or a packet truncated in the middle. The application side faults
+ *   call disconnect() or forceStop() and reconnect, or recover by hand with the
+ *   auto reconnect disabled.
+ *
+ *   Per scenario one JSON line is printed with the time from the fault until the
+ *   client noticed it, until it was connected again and until every filter was
+ *   subscribed again, the longest gap between two received messages and how many
+ *   QoS 1 messages were acknowledged, echoed, redelivered or lost.
+ *
+ *   recovery [--broker URI] [--filters N] [--rate N] [--keepalive S]
+ *            [--reconnect-timeout MS] [--scenario NAME]...
+ *
+ *   The broker defaults to PSYCHIC_MQTT_BROKER or mqtt://localhost. The proxy
+ *   forwards raw TCP, only mqtt:// is supported as the host shim has no
+ *   WebSocket transport.
+ */
+
+#include <Arduino.h>
+#include <PsychicMqttClient.h>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/*------------------------------------------------------------------------------------------------*/
+// Fault-injecting proxy
+/*------------------------------------------------------------------------------------------------*/
+
+class FaultProxy
+{
+public:
+    ~FaultProxy() { end(); }
+
+    /**
+     * @brief Listens on an ephemeral port of 127.0.0.1 and forwards every
+     * accepted connection to the upstream broker.
+     */
+    bool begin(const char *host, uint16_t port)
+    {
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo *result = nullptr;
+        char service[8];
+        snprintf(service, sizeof(service), "%u", port);
+        if (getaddrinfo(host, service, &hints, &result) != 0 || result == nullptr)
+            return false;
+        memcpy(&_upstream, result->ai_addr, result->ai_addrlen);
+        _upstreamLength = result->ai_addrlen;
+        freeaddrinfo(result);
+
+        _listener = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(_listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        if (bind(_listener, (sockaddr *)&address, sizeof(address)) != 0 || listen(_listener, 8) != 0 ||
+            getsockname(_listener, (sockaddr *)&address, &length) != 0)
+        {
+            close(_listener);
+            _listener = -1;
+            return false;
+        }
+        _port = ntohs(address.sin_port);
+        _running = true;
+        _acceptThread = std::thread(&FaultProxy::acceptLoop, this);
+        return true;
+    }
+
+    void end()
+    {
+        if (!_running.exchange(false))
+            return;
+        _acceptThread.join();
+        std::lock_guard<std::mutex> lock(_lock);
+        for (auto &connection : _connections)
+            connection->thread.join();
+        _connections.clear();
+        close(_listener);
+        _listener = -1;
+    }
+
+    uint16_t port() const { return _port; }
+
+    // Resets all open connections
+    void drop() { forEach([](Connection &connection) { connection.drop = true; }); }
+
+    // Resets new connections right after they were accepted
+    void refuse(bool refuse) { _refuse = refuse; }
+
+    // Open connections stop forwarding and silently discard everything, new connections are not affected
+    void blackhole() { forEach([](Connection &connection) { connection.blackhole = true; }); }
+
+    // Delay before every forwarded chunk
+    void setLatency(uint32_t ms) { _latency = ms; }
+
+    // The next chunk sent to the client is cut in half, then the connection is closed
+    void truncate() { _truncate = true; }
+
+private:
+    struct Connection
+    {
+        int client = -1;
+        int upstream = -1;
+        std::atomic<bool> drop{false};
+        std::atomic<bool> blackhole{false};
+        std::atomic<bool> done{false};
+        std::thread thread;
+    };
+
+    int _listener = -1;
+    uint16_t _port = 0;
+    sockaddr_storage _upstream = {};
+    socklen_t _upstreamLength = 0;
+    std::atomic<bool> _running{false};
+    std::atomic<bool> _refuse{false};
+    std::atomic<bool> _truncate{false};
+    std::atomic<uint32_t> _latency{0};
+    std::thread _acceptThread;
+    std::mutex _lock;
+    std::list<std::unique_ptr<Connection>> _connections;
+
+    template <typename F>
+    void forEach(F function)
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        for (auto &connection : _connections)
+            function(*connection);
+    }
+
+    static void closeSocket(int fd, bool reset)
+    {
+        if (reset)
+        {
+            linger option = {1, 0};
+            setsockopt(fd, SOL_SOCKET, SO_LINGER, &option, sizeof(option));
+        }
+        close(fd);
+    }
+
+    static bool sendAll(int fd, const uint8_t *data, size_t length)
+    {
+        while (length > 0)
+        {
+            ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+            if (sent <= 0)
+                return false;
+            data += sent;
+            length -= sent;
+        }
+        return true;
+    }
+
+    void acceptLoop()
+    {
+        while (_running)
+        {
+            // Join the threads of connections closed in the meantime
+            {
+                std::lock_guard<std::mutex> lock(_lock);
+                for (auto it = _connections.begin(); it != _connections.end();)
+                {
+                    if ((*it)->done)
+                    {
+                        (*it)->thread.join();
+                        it = _connections.erase(it);
+                    }
+                    else
+                        ++it;
+                }
+            }
+
+            pollfd listener = {_listener, POLLIN, 0};
+            if (poll(&listener, 1, 20) <= 0)
+                continue;
+            int client = accept(_listener, nullptr, nullptr);
+            if (client < 0)
+                continue;
+            if (_refuse)
+            {
+                closeSocket(client, true);
+                continue;
+            }
+            int upstream = socket(_upstream.ss_family, SOCK_STREAM, 0);
+            if (connect(upstream, (sockaddr *)&_upstream, _upstreamLength) != 0)
+            {
+                close(upstream);
+                closeSocket(client, true);
+                continue;
+            }
+            int on = 1;
+            setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            setsockopt(upstream, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+            std::lock_guard<std::mutex> lock(_lock);
+            _connections.emplace_back(new Connection());
+            Connection *connection = _connections.back().get();
+            connection->client = client;
+            connection->upstream = upstream;
+            connection->thread = std::thread(&FaultProxy::pump, this, connection);
+        }
+    }
+
+    void pump(Connection *connection)
+    {
+        uint8_t buffer[4096];
+        pollfd fds[2] = {{connection->client, POLLIN, 0}, {connection->upstream, POLLIN, 0}};
+        bool open = true;
+        while (open && _running && !connection->drop)
+        {
+            if (poll(fds, 2, 10) <= 0)
+                continue;
+            for (int i = 0; i < 2 && open; i++)
+            {
+                if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) == 0)
+                    continue;
+                ssize_t length = recv(fds[i].fd, buffer, sizeof(buffer), 0);
+                if (length <= 0)
+                {
+                    open = false;
+                    break;
+                }
+                if (connection->blackhole)
+                    continue;
+                if (_latency > 0)
+                    delay(_latency);
+
+                bool toClient = fds[i].fd == connection->upstream;
+                int target = toClient ? connection->client : connection->upstream;
+                if (toClient && _truncate.exchange(false))
+                {
+                    sendAll(target, buffer, length / 2);
+                    open = false;
+                    break;
+                }
+                open = sendAll(target, buffer, length);
+            }
+        }
+        bool reset = connection->drop || !_running;
+        closeSocket(connection->client, reset);
+        closeSocket(connection->upstream, reset);
+        connection->done = true;
+    }
+};
+
+/*------------------------------------------------------------------------------------------------*/
+// Scenarios
+/*------------------------------------------------------------------------------------------------*/
+
+typedef enum
+{
+    FAULT_DROP,       // proxy resets the connection
+    FAULT_OUTAGE,     // proxy resets the connection and refuses new ones for the duration
+    FAULT_HALF_OPEN,  // connection stays open but swallows all traffic in both directions
+    FAULT_SLOW,       // every chunk is delayed for the duration
+    FAULT_TRUNCATE,   // a packet to the client is cut in half, then the connection is closed
+    FAULT_DISCONNECT, // disconnect(), connect() again after the duration
+    FAULT_FORCE_STOP, // forceStop(), connect() again after the duration
+} RecoveryFault_t;
+
+typedef struct
+{
+    const char *name;
+    RecoveryFault_t fault;
+    uint32_t duration; // ms
+    bool autoReconnect;
+} RecoveryScenario_t;
+
+const RecoveryScenario_t scenarios[] = {
+    {"drop", FAULT_DROP, 0, true},
+    {"outage", FAULT_OUTAGE, 3000, true},
+    {"half_open", FAULT_HALF_OPEN, 0, true},
+    {"slow", FAULT_SLOW, 3000, true},
+    {"truncate", FAULT_TRUNCATE, 0, true},
+    {"disconnect", FAULT_DISCONNECT, 1000, true},
+    {"force_stop", FAULT_FORCE_STOP, 1000, true},
+    {"manual_reconnect", FAULT_DROP, 0, false}, // auto reconnect off, the application reconnects
+};
+
+#define RECOVERY_WARMUP_MS 1000
+#define RECOVERY_SETTLE_MS 1000  // keep publishing after the client recovered
+#define RECOVERY_TIMEOUT_MS 30000
+#define RECOVERY_DRAIN_MS 5000
+
+/**
+ * Book keeping of one scenario. The message callbacks run in the MQTT task,
+ * the publisher in the main thread.
+ */
+struct RecoveryTracker
+{
+    std::mutex lock;
+    std::vector<int> published; // msgId per sequence number, -1 if publish() failed
+    std::vector<bool> acked;
+    std::vector<uint16_t> received;
+    std::unordered_map<int, int> pending; // msgId -> sequence number
+    std::vector<int> earlyAcks;           // acknowledgements arriving before publish() returned the msgId
+    int subscribed = 0;
+    int connects = 0;
+    int disconnects = 0;
+    int64_t faultAt = 0;
+    int64_t disconnectedAt = 0;
+    int64_t connectedAt = 0;
+    int64_t resubscribedAt = 0;
+    int64_t lastReceivedAt = 0;
+    int64_t maxGap = 0;
+};
+
+const char *broker = "mqtt://localhost";
+int filters = 16;
+int rate = 200; // messages per second
+int keepAlive = 2;
+int reconnectTimeout = 1000;
+
+void printMs(const char *key, int64_t from, int64_t to)
+{
+    if (to == 0)
+        printf(",\"%s\":null", key);
+    else
+        printf(",\"%s\":%.1f", key, (to - from) / 1000.0);
+}
+
+bool waitFor(std::function<bool()> condition, uint32_t timeoutMs)
+{
+    uint32_t start = millis();
+    while (!condition())
+    {
+        if (millis() - start > timeoutMs)
+            return false;
+        delay(1);
+    }
+    return true;
+}
+
+void report(const RecoveryScenario_t &scenario, RecoveryTracker &tracker, bool recovered);
+
+void runScenario(FaultProxy &proxy, const RecoveryScenario_t &scenario)
+{
+    RecoveryTracker tracker;
+    PsychicMqttClient mqttClient;
+    String baseTopic = String("recovery/") + scenario.name;
+    String uri = String("mqtt://127.0.0.1:") + String(proxy.port());
+
+    mqttClient.setServer(uri.c_str());
+    mqttClient.setKeepAlive(keepAlive);
+    mqttClient.setAutoReconnect(scenario.autoReconnect);
+    mqttClient.getMqttConfig()->network.reconnect_timeout_ms = reconnectTimeout;
+
+    mqttClient.onConnect([&](bool sessionPresent)
+                         {
+        std::lock_guard<std::mutex> lock(tracker.lock);
+        tracker.connects++;
+        tracker.subscribed = 0;
+        if (tracker.faultAt != 0 && tracker.connectedAt == 0)
+            tracker.connectedAt = esp_timer_get_time(); });
+
+    mqttClient.onDisconnect([&](bool sessionPresent)
+                            {
+        std::lock_guard<std::mutex> lock(tracker.lock);
+        tracker.disconnects++;
+        if (tracker.faultAt != 0 && tracker.disconnectedAt == 0)
+            tracker.disconnectedAt = esp_timer_get_time(); });
+
+    mqttClient.onSubscribe([&](int msgId)
+                           {
+        std::lock_guard<std::mutex> lock(tracker.lock);
+        tracker.subscribed++;
+        if (tracker.subscribed == filters && tracker.connectedAt != 0 && tracker.resubscribedAt == 0)
+            tracker.resubscribedAt = esp_timer_get_time(); });
+
+    mqttClient.onPublish([&](int msgId)
+                         {
+        std::lock_guard<std::mutex> lock(tracker.lock);
+        auto it = tracker.pending.find(msgId);
+        if (it == tracker.pending.end())
+        {
+            tracker.earlyAcks.push_back(msgId);
+            return;
+        }
+        tracker.acked[it->second] = true;
+        tracker.pending.erase(it); });
+
+    for (int i = 0; i < filters; i++)
+    {
+        String filter = baseTopic + "/" + String(i);
+        mqttClient.onTopic(filter.c_str(), 1, [&](const char *topic, const char *payload, int retain, int qos, bool dup)
+                           {
+            int64_t now = esp_timer_get_time();
+            size_t seq = strtoul(payload, nullptr, 10);
+            std::lock_guard<std::mutex> lock(tracker.lock);
+            if (seq < tracker.received.size())
+                tracker.received[seq]++;
+            if (tracker.lastReceivedAt != 0 && now - tracker.lastReceivedAt > tracker.maxGap)
+                tracker.maxGap = now - tracker.lastReceivedAt;
+            tracker.lastReceivedAt = now; });
+    }
+
+    mqttClient.connect();
+    if (!waitFor([&]()
+                 { std::lock_guard<std::mutex> lock(tracker.lock);
+                   return mqttClient.connected() && tracker.subscribed == filters; },
+                 10000))
+    {
+        printf("{\"scenario\":\"%s\",\"error\":\"no connection to the broker\"}\n", scenario.name);
+        fflush(stdout);
+        mqttClient.disconnect();
+        return;
+    }
+
+    // Publish numbered messages at a steady rate. Faults and recovery are driven from the same loop.
+    int64_t start = esp_timer_get_time();
+    int64_t interval = 1000000 / rate;
+    int64_t faultEnd = 0;
+    int64_t recoveredAt = 0;
+    bool faultInjected = false;
+    bool faultEnded = false;
+    bool manualReconnect = false;
+    char payload[16];
+    for (int seq = 0;; seq++)
+    {
+        int64_t now = esp_timer_get_time();
+        if (!faultInjected && now - start >= RECOVERY_WARMUP_MS * 1000)
+        {
+            faultInjected = true;
+            {
+                std::lock_guard<std::mutex> lock(tracker.lock);
+                tracker.faultAt = now;
+            }
+            faultEnd = now + scenario.duration * 1000;
+            switch (scenario.fault)
+            {
+            case FAULT_DROP:
+                proxy.drop();
+                break;
+            case FAULT_OUTAGE:
+                proxy.refuse(true);
+                proxy.drop();
+                break;
+            case FAULT_HALF_OPEN:
+                proxy.blackhole();
+                break;
+            case FAULT_SLOW:
+                proxy.setLatency(300);
+                break;
+            case FAULT_TRUNCATE:
+                proxy.truncate();
+                break;
+            case FAULT_DISCONNECT:
+                mqttClient.disconnect();
+                break;
+            case FAULT_FORCE_STOP:
+                mqttClient.forceStop();
+                break;
+            }
+        }
+        if (faultInjected && !faultEnded && now >= faultEnd)
+        {
+            faultEnded = true;
+            switch (scenario.fault)
+            {
+            case FAULT_OUTAGE:
+                proxy.refuse(false);
+                break;
+            case FAULT_SLOW:
+                proxy.setLatency(0);
+                break;
+            case FAULT_DISCONNECT:
+            case FAULT_FORCE_STOP:
+                mqttClient.connect();
+                break;
+            default:
+                break;
+            }
+        }
+
+        bool disconnected;
+        bool resubscribed;
+        {
+            std::lock_guard<std::mutex> lock(tracker.lock);
+            disconnected = tracker.disconnectedAt != 0;
+            resubscribed = tracker.resubscribedAt != 0;
+        }
+        // Without auto reconnect the application has to restart the client
+        if (!scenario.autoReconnect && disconnected && !manualReconnect)
+        {
+            manualReconnect = true;
+            mqttClient.forceStop();
+            mqttClient.connect();
+        }
+        if (faultEnded && recoveredAt == 0 && (scenario.fault == FAULT_SLOW ? true : resubscribed))
+            recoveredAt = now;
+        if ((recoveredAt != 0 && now - recoveredAt > RECOVERY_SETTLE_MS * 1000) ||
+            (faultInjected && now - tracker.faultAt > RECOVERY_TIMEOUT_MS * 1000))
+            break;
+
+        String topic = baseTopic + "/" + String(seq % filters);
+        snprintf(payload, sizeof(payload), "%d", seq);
+        {
+            std::lock_guard<std::mutex> lock(tracker.lock);
+            tracker.published.push_back(-1);
+            tracker.acked.push_back(false);
+            tracker.received.push_back(0);
+        }
+        int msgId = mqttClient.publish(topic.c_str(), 1, false, payload);
+        {
+            std::lock_guard<std::mutex> lock(tracker.lock);
+            tracker.published[seq] = msgId;
+            if (msgId > 0)
+            {
+                auto early = std::find(tracker.earlyAcks.begin(), tracker.earlyAcks.end(), msgId);
+                if (early != tracker.earlyAcks.end())
+                {
+                    tracker.acked[seq] = true;
+                    tracker.earlyAcks.erase(early);
+                }
+                else
+                    tracker.pending[msgId] = seq;
+            }
+        }
+
+        int64_t next = start + (int64_t)(seq + 1) * interval;
+        while (esp_timer_get_time() < next)
+            delay(1);
+    }
+
+    // Drain, the outbox retransmits whatever is still unacknowledged
+    waitFor([&]()
+            {
+        std::lock_guard<std::mutex> lock(tracker.lock);
+        for (size_t seq = 0; seq < tracker.published.size(); seq++)
+        {
+            if (tracker.published[seq] > 0 && (!tracker.acked[seq] || tracker.received[seq] == 0))
+                return false;
+        }
+        return true; },
+            RECOVERY_DRAIN_MS);
+    report(scenario, tracker, recoveredAt != 0);
+    mqttClient.disconnect();
+}
+
+void report(const RecoveryScenario_t &scenario, RecoveryTracker &tracker, bool recovered)
+{
+    std::lock_guard<std::mutex> lock(tracker.lock);
+    int published = 0, rejected = 0, acked = 0, received = 0, duplicates = 0, lost = 0, unacked = 0;
+    for (size_t seq = 0; seq < tracker.published.size(); seq++)
+    {
+        if (tracker.published[seq] <= 0)
+        {
+            rejected++;
+            continue;
+        }
+        published++;
+        if (tracker.acked[seq])
+            acked++;
+        else
+            unacked++;
+        if (tracker.received[seq] > 0)
+            received++;
+        if (tracker.received[seq] > 1)
+            duplicates += tracker.received[seq] - 1;
+        if (tracker.acked[seq] && tracker.received[seq] == 0)
+            lost++;
+    }
+
+    printf("{\"scenario\":\"%s\",\"autoReconnect\":%s,\"filters\":%d,\"recovered\":%s", scenario.name,
+           scenario.autoReconnect ? "true" : "false", filters, recovered ? "true" : "false");
+    printMs("detectMs", tracker.faultAt, tracker.disconnectedAt);
+    printMs("reconnectMs", tracker.faultAt, tracker.connectedAt);
+    printMs("resubscribeMs", tracker.faultAt, tracker.resubscribedAt);
+    printf(",\"maxGapMs\":%.1f,\"connects\":%d,\"disconnects\":%d,\"published\":%d,\"rejected\":%d,\"acked\":%d,"
+           "\"unacked\":%d,\"received\":%d,\"duplicates\":%d,\"lost\":%d}\n",
+           tracker.maxGap / 1000.0, tracker.connects, tracker.disconnects, published, rejected, acked, unacked,
+           received, duplicates, lost);
+    fflush(stdout);
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: recovery [--broker URI] [--filters N] [--rate N] [--keepalive S] "
+                    "[--reconnect-timeout MS] [--scenario NAME]...\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    if (getenv("PSYCHIC_MQTT_BROKER") != nullptr)
+        broker = getenv("PSYCHIC_MQTT_BROKER");
+    std::vector<const char *> selected;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--broker") == 0 && i + 1 < argc)
+            broker = argv[++i];
+        else if (strcmp(argv[i], "--filters") == 0 && i + 1 < argc)
+            filters = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc)
+            rate = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--keepalive") == 0 && i + 1 < argc)
+            keepAlive = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--reconnect-timeout") == 0 && i + 1 < argc)
+            reconnectTimeout = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--scenario") == 0 && i + 1 < argc)
+            selected.push_back(argv[++i]);
+        else
+            usage();
+    }
+    if (filters < 1 || rate < 1 || keepAlive < 1)
+        usage();
+
+    // The shim would redirect the client past the proxy
+    String upstream = broker;
+    unsetenv("PSYCHIC_MQTT_BROKER");
+
+    if (!upstream.startsWith("mqtt://"))
+    {
+        fprintf(stderr, "only mqtt:// brokers are supported\n");
+        return 2;
+    }
+    String host = upstream.substring(7);
+    uint16_t port = 1883;
+    int colon = host.indexOf(':');
+    if (colon >= 0)
+    {
+        port = atoi(host.substring(colon + 1).c_str());
+        host = host.substring(0, colon);
+    }
+
+    FaultProxy proxy;
+    if (!proxy.begin(host.c_str(), port))
+    {
+        fprintf(stderr, "cannot resolve %s or open the proxy port\n", host.c_str());
+        return 1;
+    }
+
+    for (const auto &scenario : scenarios)
+    {
+        bool run = selected.empty();
+        for (const char *name : selected)
+            run |= strcmp(name, scenario.name) == 0;
+        if (run)
+            runScenario(proxy, scenario);
+    }
+    proxy.end();
+    return 0;
+}
+
+// The shim's Arduino.h declares the sketch functions, this tool has its own main()
+void setup() {}
+void loop() {}
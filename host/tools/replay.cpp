@@ -0,0 +1,142 @@
+/**
+ *   PsychicMqttClient host tools
+ *
+ *   Records the raw MQTT event stream of a live connection and replays a
+ *   recording into a PsychicMqttClient instance without any network.
+ *
+ *   replay record <file> [--broker URI] [--seconds N] [--filter TOPIC]...
+ *   replay play <file> [--realtime] [--repeat N] [--filter TOPIC]...
+ *
+ *   Recordings made on the ESP32 with setEventRecorder() can be replayed as well.
+ *   Replay with the same onTopic filters as the application to benchmark its
+ *   matcher, reassembly and dispatch path.
+ */
+
+#include <Arduino.h>
+#include <PsychicMqttClient.h>
+
+#include <atomic>
+#include <vector>
+
+class FilePrint : public Print
+{
+public:
+    explicit FilePrint(FILE *file) : _file(file) {}
+    size_t write(uint8_t c) override { return fwrite(&c, 1, 1, _file); }
+    size_t write(const uint8_t *buffer, size_t size) override { return fwrite(buffer, 1, size, _file); }
+
+private:
+    FILE *_file;
+};
+
+static void usage()
+{
+    fprintf(stderr, "usage: replay record <file> [--broker URI] [--seconds N] [--filter TOPIC]...\n"
+                    "       replay play <file> [--realtime] [--repeat N] [--filter TOPIC]...\n");
+    exit(2);
+}
+
+static int record(const char *path, const char *broker, int seconds, const std::vector<const char *> &filters)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr)
+    {
+        perror(path);
+        return 1;
+    }
+    FilePrint output(file);
+
+    PsychicMqttClient mqttClient;
+    mqttClient.setServer(broker);
+    for (const char *filter : filters)
+        mqttClient.onTopic(filter, 2, [](const char *, const char *, int, int, bool) {});
+    mqttClient.setEventRecorder(&output);
+    mqttClient.connect();
+
+    delay(seconds * 1000);
+    mqttClient.disconnect();
+    mqttClient.setEventRecorder(nullptr);
+    fclose(file);
+    return 0;
+}
+
+static int play(const char *path, bool realtime, int repeat, const std::vector<const char *> &filters)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        perror(path);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    std::vector<uint8_t> recording(length > 0 ? length : 0);
+    size_t read = fread(recording.data(), 1, recording.size(), file);
+    fclose(file);
+
+    std::atomic<uint32_t> delivered(0);
+    PsychicMqttClient mqttClient;
+    if (filters.empty())
+        mqttClient.onMessage([&](char *, char *, int, int, bool)
+                             { delivered.fetch_add(1, std::memory_order_relaxed); });
+    for (const char *filter : filters)
+        mqttClient.onTopic(filter, 2, [&](const char *, const char *, int, int, bool)
+                           { delivered.fetch_add(1, std::memory_order_relaxed); });
+
+    PsychicMqttReplay replay(mqttClient);
+    int events = 0;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < repeat; i++)
+    {
+        int replayed = replay.replay(recording.data(), read, realtime);
+        if (replayed < 0)
+        {
+            fprintf(stderr, "%s: not a valid recording\n", path);
+            return 1;
+        }
+        events += replayed;
+    }
+    double seconds = (esp_timer_get_time() - start) / 1000000.0;
+
+    printf("{\"events\":%d,\"delivered\":%u,\"seconds\":%.6f,\"eventsPerSec\":%.1f}\n", events,
+           (unsigned)delivered.load(), seconds, seconds > 0 ? events / seconds : 0.0);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+        usage();
+
+    const char *broker = getenv("PSYCHIC_MQTT_BROKER") != nullptr ? getenv("PSYCHIC_MQTT_BROKER") : "mqtt://localhost";
+    int seconds = 10;
+    int repeat = 1;
+    bool realtime = false;
+    std::vector<const char *> filters;
+    for (int i = 3; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--broker") == 0 && i + 1 < argc)
+            broker = argv[++i];
+        else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+            seconds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+            repeat = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            filters.push_back(argv[++i]);
+        else if (strcmp(argv[i], "--realtime") == 0)
+            realtime = true;
+        else
+            usage();
+    }
+
+    if (strcmp(argv[1], "record") == 0)
+        return record(argv[2], broker, seconds, filters);
+    if (strcmp(argv[1], "play") == 0)
+        return play(argv[2], realtime, repeat, filters);
+    usage();
+}
+
+// The shim's Arduino.h declares the sketch functions, this tool has its own main()
+void setup() {}
+void loop() {}
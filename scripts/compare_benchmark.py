@@ -0,0 +1,68 @@
+#!/usr/bin/env python
+#
+# Compares two runs of the Benchmark example
+#
+# Reads the JSON result lines from a serial log or a file written by the host build,
+# matches the scenarios of both runs and prints the change of throughput and of the
+# p99 echo latency. Exits with 1 if any scenario regressed by more than the threshold.
+#
+# usage: compare_benchmark.py baseline.jsonl current.jsonl [--threshold 10]
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    results = {}
+    with open(path, encoding="utf-8", errors="replace") as f:
+        for line in f:
+            line = line.strip()
+            if not line.startswith("{"):
+                continue
+            try:
+                result = json.loads(line)
+            except ValueError:
+                continue
+            if result.get("bench") != "psychic-mqtt":
+                continue
+            key = (result["qos"], result["payload"], result["filters"], result["async"])
+            results[key] = result
+    return results
+
+
+def change(old, new):
+    return (new - old) * 100.0 / old if old else 0.0
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare two PsychicMqttClient benchmark runs")
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=10.0, help="allowed regression in percent")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    current = load(args.current)
+    regressions = 0
+
+    print("%-4s %8s %8s %6s %12s %8s %10s %8s" % ("qos", "payload", "filters", "async", "msgs/s", "change",
+                                                  "p99 us", "change"))
+    for key in sorted(baseline.keys() & current.keys()):
+        old, new = baseline[key], current[key]
+        rate = change(old["msgsPerSec"], new["msgsPerSec"])
+        p99 = change(old["echoUs"]["p99"], new["echoUs"]["p99"]) if old["echoUs"] and new["echoUs"] else 0.0
+        regressed = rate < -args.threshold or p99 > args.threshold or new["received"] < new["sent"]
+        regressions += regressed
+        print("%-4d %8d %8d %6s %12.1f %+7.1f%% %10d %+7.1f%%%s" % (
+            key[0], key[1], key[2], "yes" if key[3] else "no", new["msgsPerSec"], rate,
+            new["echoUs"]["p99"] if new["echoUs"] else 0, p99, "  REGRESSION" if regressed else ""))
+
+    for key in sorted(baseline.keys() ^ current.keys()):
+        print("scenario qos=%d payload=%d filters=%d async=%s only in one run" % key)
+
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,193 @@
+#pragma once
+/**
+ *   PsychicMqttClient
+ *
+ *   Awaiters for C++20 coroutines. publishAsync(), subscribeAsync() and
+ *   connectedAsync() of PsychicMqttClient return an awaiter that registers a
+ *   one-shot completion handler and resumes the coroutine from it. The
+ *   awaiter lives in the coroutine frame and the handler only captures its
+ *   address, which fits into the small buffer of std::function, so awaiting
+ *   allocates nothing.
+ *
+ *   The handler may run before, during or after the coroutine suspends,
+ *   e.g. synchronously for a dropped message. An atomic flag decides which
+ *   side comes last, only that side continues the coroutine.
+ *
+ *   PsychicMqttTask is a fire-and-forget coroutine type whose frames come
+ *   from PsychicMqttFramePool::shared(). It runs in the calling task up to
+ *   the first suspension, then in the task that completed the operation,
+ *   usually the MQTT task.
+ *
+ *   Only available when compiled as C++20 with coroutine support, e.g. with
+ *   Arduino ESP32 3.x. The awaiters take the client as a template parameter,
+ *   so they can be declared before PsychicMqttClient.
+ */
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define PSYCHIC_MQTT_COROUTINES 1
+#endif
+#endif
+
+#ifdef PSYCHIC_MQTT_COROUTINES
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+
+#include "PsychicMqttCompletion.h"
+#include "PsychicMqttFramePool.h"
+
+typedef struct
+{
+    PsychicMqttPublishStatus_t status;
+    int msgId;
+    uint32_t rtt; // time until completion in microseconds
+} PsychicMqttAwaitResult_t;
+
+/**
+ * @brief Coroutine type for fire-and-forget tasks that co_await the client. The coroutine
+ * starts right away and its frame is released when it returns. If no frame can be
+ * allocated, the coroutine does not run.
+ */
+class PsychicMqttTask
+{
+public:
+    struct promise_type
+    {
+        PsychicMqttTask get_return_object() noexcept { return PsychicMqttTask(); }
+        static PsychicMqttTask get_return_object_on_allocation_failure() noexcept { return PsychicMqttTask(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+
+        static void *operator new(size_t size) noexcept { return PsychicMqttFramePool::shared().allocate(size); }
+        static void operator delete(void *frame) noexcept { PsychicMqttFramePool::shared().release(frame); }
+    };
+};
+
+class PsychicMqttAwaiter
+{
+public:
+    PsychicMqttAwaiter() = default;
+    PsychicMqttAwaiter(const PsychicMqttAwaiter &) = delete;
+    PsychicMqttAwaiter &operator=(const PsychicMqttAwaiter &) = delete;
+
+protected:
+    std::coroutine_handle<> _handle;
+    std::atomic<bool> _last{false};
+
+    // Called by the handler, resumes the coroutine if it already suspended
+    void _complete()
+    {
+        if (_last.exchange(true))
+            _handle.resume();
+    }
+
+    // Called by await_suspend() after starting the operation, false resumes right away
+    bool _suspend() { return !_last.exchange(true); }
+};
+
+template <typename Client>
+class PsychicMqttPublishAwaiter : public PsychicMqttAwaiter
+{
+public:
+    PsychicMqttPublishAwaiter(Client &client, const char *topic, int qos, bool retain, const char *payload, int length,
+                              uint32_t timeoutMs)
+        : _client(client), _topic(topic), _qos(qos), _retain(retain), _payload(payload), _length(length),
+          _timeoutMs(timeoutMs)
+    {
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        _handle = handle;
+        _client.publish(_topic, _qos, _retain, _payload, _length,
+                        [this](PsychicMqttPublishStatus_t status, int msgId, uint32_t rtt)
+                        {
+                            _result = {status, msgId, rtt};
+                            _complete();
+                        },
+                        _timeoutMs);
+        return _suspend();
+    }
+
+    PsychicMqttAwaitResult_t await_resume() const noexcept { return _result; }
+
+private:
+    Client &_client;
+    const char *_topic;
+    int _qos;
+    bool _retain;
+    const char *_payload;
+    int _length;
+    uint32_t _timeoutMs;
+    PsychicMqttAwaitResult_t _result = {};
+};
+
+template <typename Client>
+class PsychicMqttSubscribeAwaiter : public PsychicMqttAwaiter
+{
+public:
+    PsychicMqttSubscribeAwaiter(Client &client, const char *topic, int qos, uint32_t timeoutMs)
+        : _client(client), _topic(topic), _qos(qos), _timeoutMs(timeoutMs)
+    {
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        _handle = handle;
+        _client.subscribe(_topic, _qos,
+                          [this](PsychicMqttPublishStatus_t status, int msgId, uint32_t rtt)
+                          {
+                              _result = {status, msgId, rtt};
+                              _complete();
+                          },
+                          _timeoutMs);
+        return _suspend();
+    }
+
+    PsychicMqttAwaitResult_t await_resume() const noexcept { return _result; }
+
+private:
+    Client &_client;
+    const char *_topic;
+    int _qos;
+    uint32_t _timeoutMs;
+    PsychicMqttAwaitResult_t _result = {};
+};
+
+template <typename Client>
+class PsychicMqttConnectedAwaiter : public PsychicMqttAwaiter
+{
+public:
+    explicit PsychicMqttConnectedAwaiter(Client &client) : _client(client) {}
+
+    bool await_ready() { return _client.connected(); }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        _handle = handle;
+        _client.whenConnected(
+            [this](bool connected)
+            {
+                _connected = connected;
+                _complete();
+            });
+        return _suspend();
+    }
+
+    bool await_resume() const noexcept { return _connected; }
+
+private:
+    Client &_client;
+    bool _connected = true; // also the result if await_ready() found the client connected
+};
+
+#endif
@@ -0,0 +1,73 @@
+#include "PsychicMqttBatch.h"
+
+PsychicMqttBatch::PsychicMqttBatch(uint32_t latencyMs, size_t limit) : _queue(limit), _latencyMs(latencyMs)
+{
+    _lock = xSemaphoreCreateMutex();
+}
+
+PsychicMqttBatch::~PsychicMqttBatch()
+{
+    vSemaphoreDelete(_lock);
+}
+
+bool PsychicMqttBatch::add(int64_t now, const char *topic, const char *payload, int length, int qos, bool retain,
+                           const OnPublishCompleteUserCallback *onComplete, uint32_t timeoutMs, int priority,
+                           bool &started)
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    bool added = _queue.push(topic, payload, length, qos, retain, onComplete, timeoutMs, priority);
+    started = added && _stats.buffered == 0;
+    if (started)
+        _startedAt = now;
+    if (added)
+    {
+        // Sent right away, the message would have shared the wakeup of the previous one
+        // only if the radio was still awake
+        if (_wakeups == 0 || now - _lastArrival > (int64_t)PSYCHIC_MQTT_BATCH_RADIO_TAIL_MS * 1000)
+            _wakeups++;
+        _lastArrival = now;
+        _stats.buffered++;
+    }
+    xSemaphoreGive(_lock);
+    return added;
+}
+
+PsychicMqttQueue::Message *PsychicMqttBatch::pop()
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    PsychicMqttQueue::Message *message = _queue.pop();
+    if (message != nullptr)
+        _stats.buffered--;
+    xSemaphoreGive(_lock);
+    return message;
+}
+
+int64_t PsychicMqttBatch::due()
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    int64_t due = _stats.buffered > 0 ? _startedAt + (int64_t)_latencyMs * 1000 : 0;
+    xSemaphoreGive(_lock);
+    return due;
+}
+
+void PsychicMqttBatch::flushed(uint32_t messages)
+{
+    if (messages == 0)
+        return;
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    _stats.messages += messages;
+    _stats.bursts++;
+    xSemaphoreGive(_lock);
+}
+
+PsychicMqttBatchStats_t PsychicMqttBatch::stats()
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    PsychicMqttBatchStats_t stats = _stats;
+    // Messages still buffered will be sent in one more burst
+    uint32_t bursts = _stats.bursts + (_stats.buffered > 0 ? 1 : 0);
+    stats.wakeupsAvoided = _wakeups > bursts ? _wakeups - bursts : 0;
+    stats.radioOnSavedMs = stats.wakeupsAvoided * PSYCHIC_MQTT_BATCH_RADIO_TAIL_MS;
+    xSemaphoreGive(_lock);
+    return stats;
+}
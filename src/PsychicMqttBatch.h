@@ -0,0 +1,96 @@
+#pragma once
+/**
+ *   PsychicMqttClient
+ *
+ *   Publish batching for devices in modem sleep. Every transmission keeps the
+ *   radio awake for a while after the last packet, so publishes trickling in
+ *   from several tasks keep it awake almost permanently. The batch holds
+ *   messages until the oldest one reaches the latency budget and the client
+ *   sends them in one burst.
+ *
+ *   The radio-on time saved is estimated from the arrival times: without
+ *   batching, a message arriving more than PSYCHIC_MQTT_BATCH_RADIO_TAIL_MS
+ *   after the previous one would have woken the radio again. Each of those
+ *   wakeups minus the bursts actually sent saves one tail.
+ *
+ *   The class holds no timer and takes the time as a parameter, the client
+ *   arms a timer when add() starts a batch and flushes once due() passed.
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+#include "PsychicMqttQueue.h"
+
+#ifndef PSYCHIC_MQTT_BATCH_RADIO_TAIL_MS
+#define PSYCHIC_MQTT_BATCH_RADIO_TAIL_MS 50 // ms the radio stays awake after a transmission
+#endif
+
+typedef struct
+{
+    uint32_t messages;       // messages sent in bursts
+    uint32_t bursts;         // bursts sent
+    uint32_t wakeupsAvoided; // estimated radio wakeups without batching minus bursts
+    uint32_t radioOnSavedMs; // wakeupsAvoided times PSYCHIC_MQTT_BATCH_RADIO_TAIL_MS
+    uint32_t buffered;       // messages waiting for the next burst
+} PsychicMqttBatchStats_t;
+
+class PsychicMqttBatch
+{
+public:
+    /**
+     * @param latencyMs Time the oldest message may wait for the burst.
+     * @param limit Maximum bytes of the buffered messages, including their headers.
+     */
+    PsychicMqttBatch(uint32_t latencyMs, size_t limit);
+
+    /**
+     * @brief Completes the buffered messages with a handler as dropped.
+     */
+    ~PsychicMqttBatch();
+
+    /**
+     * @brief Copies a message into the batch.
+     *
+     * @param now esp_timer_get_time() at the publish.
+     * @param started Set to true if the message started a new batch, which is due
+     * latency() later.
+     * @return False if the message does not fit, flush the batch and add it again.
+     */
+    bool add(int64_t now, const char *topic, const char *payload, int length, int qos, bool retain,
+             const OnPublishCompleteUserCallback *onComplete, uint32_t timeoutMs, int priority, bool &started);
+
+    /**
+     * @brief Removes the next message of a burst, the caller frees it with
+     * PsychicMqttQueue::release().
+     *
+     * @return The message, or nullptr once the batch is empty.
+     */
+    PsychicMqttQueue::Message *pop();
+
+    /**
+     * @brief Counts a burst of sent messages.
+     */
+    void flushed(uint32_t messages);
+
+    /**
+     * @brief Returns when the oldest message reaches the latency budget, a timer armed for
+     * an earlier batch that was flushed early fires before that.
+     *
+     * @return esp_timer_get_time() the burst is due, 0 if the batch is empty.
+     */
+    int64_t due();
+
+    uint32_t latency() { return _latencyMs; }
+
+    PsychicMqttBatchStats_t stats();
+
+private:
+    PsychicMqttQueue _queue;
+    SemaphoreHandle_t _lock;
+    uint32_t _latencyMs;
+    int64_t _startedAt = 0;
+    int64_t _lastArrival = 0;
+    uint32_t _wakeups = 0; // estimated without batching
+    PsychicMqttBatchStats_t _stats = {};
+};
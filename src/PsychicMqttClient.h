@@ -31,38 +31,165 @@
  *   SOFTWARE.
  */
 
+#include <atomic>
 #include <functional>
+#include <utility>
 #include <vector>
 
 #include "Arduino.h"
 #include "mqtt_client.h"
 #include "esp_crt_bundle.h"
+#include "esp_timer.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "PsychicMqttTrace.h"
+#include "PsychicMqttAwait.h"
+#include "PsychicMqttBatch.h"
+#include "PsychicMqttCompletion.h"
+#include "PsychicMqttDedup.h"
+#include "PsychicMqttDispatcher.h"
+#include "PsychicMqttKeepAlive.h"
+#include "PsychicMqttLanes.h"
+#include "PsychicMqttQueue.h"
+#include "PsychicMqttRateControl.h"
+#include "PsychicMqttRegistry.h"
+#include "PsychicMqttReplay.h"
+#include "PsychicMqttRetainedCache.h"
+#include "PsychicMqttRpc.h"
+#include "PsychicMqttTransport.h"
 
 #define PSYCHIC_MQTT_CLIENT_VERSION_STR "0.2.1"
 #define PSYCHIC_MQTT_CLIENT_VERSION_MAJOR 0
 #define PSYCHIC_MQTT_CLIENT_VERSION_MINOR 2
 #define PSYCHIC_MQTT_CLIENT_VERSION_PATCH 1
 
-#ifndef ARDUINO_ARCH_ESP32
+#if !defined(ARDUINO_ARCH_ESP32) && !defined(PSYCHIC_MQTT_HOST)
 #error "This library only supports boards with an ESP32 processor."
 #endif
 
+// Connection state as returned by state() and awaited by waitFor()
+typedef enum
+{
+    PSYCHIC_MQTT_STATE_IDLE = 0,      // connect() was never called
+    PSYCHIC_MQTT_STATE_CONNECTING,    // waiting for the CONNACK, also while reconnecting automatically
+    PSYCHIC_MQTT_STATE_CONNECTED,     // CONNACK received, publish and subscribe are possible
+    PSYCHIC_MQTT_STATE_DISCONNECTING, // disconnect() waits for the DISCONNECT to be sent
+    PSYCHIC_MQTT_STATE_STOPPED,       // stopped by disconnect() or forceStop(), or lost with auto reconnect disabled
+} PsychicMqttState_t;
+
+// Maximum time disconnect() waits for the DISCONNECT to be sent
+#define PSYCHIC_MQTT_DISCONNECT_TIMEOUT_MS 5000
+
+// Default time publish() with a completion handler waits for the acknowledgement
+#define PSYCHIC_MQTT_PUBLISH_TIMEOUT_MS 30000
+
+// Outcome of shutdown()
+typedef struct
+{
+    uint32_t flushed;   // QoS 1 and 2 messages acknowledged while draining
+    uint32_t abandoned; // QoS 1 and 2 messages still unacknowledged or queued when the client stopped
+    uint32_t duration;  // milliseconds
+} PsychicMqttShutdownResult_t;
+
 // user callbacks
 typedef std::function<void(bool sessionPresent)> OnConnectUserCallback;
 typedef std::function<void(bool sessionPresent)> OnDisconnectUserCallback;
 typedef std::function<void(int msgId)> OnSubscribeUserCallback;
+typedef std::function<void(bool connected)> OnceConnectedUserCallback;
 typedef std::function<void(int msgId)> OnUnsubscribeUserCallback;
 typedef std::function<void(char *topic, char *payload, int retain, int qos, bool dup)> OnMessageUserCallback;
 typedef std::function<void(int msgId)> OnPublishUserCallback;
 typedef std::function<void(esp_mqtt_error_codes_t error)> OnErrorUserCallback;
+typedef std::function<void(uint32_t handle, uint32_t micros)> OnSlowHandlerUserCallback;
+typedef std::function<void(const PsychicMqttRetainedView &view)> OnRetainedUserCallback;
+typedef std::function<String(const char *topic, const char *payload, int length)> OnRpcRequestUserCallback;
+typedef std::function<void(const char *topic, const char *payload, int length, int qos, bool retain)> OnPublishRejectedUserCallback;
+typedef std::function<size_t(uint8_t *buffer, size_t maxLength)> PayloadProducerUserCallback;
+
+// Execution time histogram with two buckets per power of two, covering up to ~1 s
+#define PSYCHIC_MQTT_PROFILE_BUCKETS 40
+
+// Execution time bookkeeping of a registered event handler, all times in microseconds
+typedef struct
+{
+    uint32_t handle;
+    uint32_t invocations;
+    uint64_t totalTime;
+    uint32_t maxTime;
+    uint16_t histogram[PSYCHIC_MQTT_PROFILE_BUCKETS];
+} PsychicMqttHandlerTiming_t;
+
+template <typename T>
+struct PsychicMqttHandler_t
+{
+    T callback;
+    PsychicMqttHandlerTiming_t timing;
+};
 
 typedef struct
 {
     char *topic;
     int qos;
+    PsychicMqttPriority_t priority; // dispatch class with setDispatchQueue()
     OnMessageUserCallback callback;
+    PsychicMqttHandlerTiming_t timing;
 } OnMessageUserCallback_t;
 
+// Execution profile of a registered event handler as returned by getHandlerProfiles()
+typedef struct
+{
+    uint32_t handle;           // handles are assigned in registration order starting at 0
+    esp_mqtt_event_id_t event; // event the handler is registered for
+    const char *topic;         // topic filter of onTopic() handlers, nullptr otherwise
+    uint32_t invocations;
+    uint64_t totalTime; // microseconds
+    uint32_t maxTime;   // microseconds
+    uint32_t p99Time;   // microseconds, upper bound of the histogram bucket
+} PsychicMqttHandlerProfile_t;
+
+// Duration statistics of a single connection phase, all values in microseconds
+typedef struct
+{
+    uint32_t samples;
+    uint32_t last;
+    uint32_t min;
+    uint32_t max;
+    uint32_t ewma; // exponentially weighted moving average with alpha = 1/8
+} PsychicMqttPhaseStats_t;
+
+typedef struct
+{
+    uint32_t attempts;                   // connection attempts started
+    uint32_t successes;                  // attempts that received a CONNACK
+    PsychicMqttPhaseStats_t dns;         // resolving the broker, only recorded with setDnsCache()
+    PsychicMqttPhaseStats_t connect;     // TCP connect, TLS handshake and CONNACK
+    PsychicMqttPhaseStats_t resubscribe; // CONNACK until all onTopic() subscriptions are acknowledged
+    PsychicMqttPhaseStats_t total;       // start of the attempt until resubscription completed
+} PsychicMqttConnectStats_t;
+
+typedef std::function<void(const PsychicMqttConnectStats_t &stats)> OnConnectStatsUserCallback;
+
+// Histogram bucket i counts durations below 4^(i+2) microseconds, the last one everything above
+#define PSYCHIC_MQTT_HISTOGRAM_BUCKETS 8
+
+typedef struct
+{
+    uint32_t messagesIn[3];  // received messages per QoS
+    uint32_t bytesIn[3];     // received payload bytes per QoS
+    uint32_t messagesOut[3]; // published messages per QoS
+    uint32_t bytesOut[3];    // published payload bytes per QoS
+    uint32_t multipartReassemblies;
+    uint32_t droppedPublishes;
+    uint32_t suppressedDuplicates; // QoS 1 redeliveries dropped by setDuplicateFilter()
+    uint32_t queuedPublishes;      // publishes that waited for room in the in-flight window
+    uint32_t subscribes;
+    uint32_t unsubscribes;
+    uint32_t reconnects;
+    uint32_t dispatchHistogram[PSYCHIC_MQTT_HISTOGRAM_BUCKETS]; // time spent in the message callbacks
+    uint32_t rttHistogram[PSYCHIC_MQTT_RTT_BUCKETS];            // publish to acknowledgement time of publishes with a completion handler
+    PsychicMqttLaneStats_t lanes[PSYCHIC_MQTT_PRIORITY_LANES];  // in-flight window queue per priority class
+} PsychicMqttStats_t;
+
 /**
  * @class PsychicMqttClient
  * @brief A class that wraps the ESP-IDF MQTT client and provides a more user friendly interface.
@@ -90,6 +217,34 @@ public:
      */
     PsychicMqttClient &setKeepAlive(int keepAlive = 120);
 
+    /**
+     * @brief Tunes the keep alive interval of every connection within bounds. Links with a
+     * short round trip get the minimum, so a dead connection is detected quickly, slow
+     * links such as cellular the maximum, so the radio wakes up less often. After a
+     * connection that lasted two keep alives timed out while idle for longer than its keep
+     * alive, e.g. by a NAT timeout, the keep alive is capped below the value that failed.
+     * Transport errors and a network interface going down do not count. The round trip is
+     * measured with PSYCHIC_MQTT_KEEPALIVE_PROBES QoS 1 publishes with an empty payload,
+     * which every connect sends and which count towards the traffic of metered links. A new
+     * keep alive takes effect with the next connection. Call before connect().
+     *
+     * @param minKeepAlive Lower bound in seconds, 0 disables the adaptive keep alive.
+     * @param maxKeepAlive Upper bound in seconds.
+     * @param probeTopic Topic of the probe publishes, nobody should subscribe to it. nullptr
+     * disables the probes, the keep alive then only adapts to idle drops. Defaults to nullptr.
+     * @return A reference to the PsychicMqttClient instance.
+     */
+    PsychicMqttClient &setAdaptiveKeepAlive(uint16_t minKeepAlive, uint16_t maxKeepAlive,
+                                            const char *probeTopic = nullptr);
+
+    /**
+     * @brief Returns the state of the adaptive keep alive.
+     *
+     * @return The keep alive, the probe round trips and the idle drops, all zero if the
+     * adaptive keep alive is disabled.
+     */
+    PsychicMqttKeepAliveStats_t keepAliveStats();
+
     /**
      * @brief Sets the auto reconnect flag for the MQTT connection.
      *
@@ -214,6 +369,43 @@ public:
      */
     PsychicMqttClient &setServer(const char *uri);
 
+    /**
+     * @brief Runs the connection over a custom transport instead of the one selected
+     * by the URI scheme, e.g. an in-memory loopback, a UART bridge or a modem data
+     * channel. setServer() is still required, its host and port are passed to the
+     * transport's connect function. The ESP-IDF MQTT client destroys the transport
+     * together with the client.
+     *
+     * @note Requires ESP-IDF 5.
+     *
+     * @param transport The transport handle, see PsychicMqttLoopback and
+     * PsychicMqttFdTransport. nullptr restores the default transport.
+     * @return A reference to the PsychicMqttClient instance.
+     */
+    PsychicMqttClient &setTransport(esp_transport_handle_t transport);
+
+    /**
+     * @brief Enables caching of the resolved broker address. The hostname from setServer()
+     * is resolved once and reconnects go straight to the cached IP address. The hostname is
+     * only resolved again once the cached address has expired or a connection attempt with
+     * it failed. Should the resolver fail, the last known address is used instead.
+     * SNI and certificate verification keep using the original hostname.
+     *
+     * @note Only applies to mqtt:// and mqtts:// URIs. With ESP-IDF 4 only mqtt:// is
+     * supported, as the certificate common name cannot be set independently of the host.
+     *
+     * @param enable Whether to enable the DNS cache. Defaults to true.
+     * @param ttl Time in seconds a resolved address is considered fresh. Defaults to 300.
+     * @return A reference to the PsychicMqttClient instance.
+     */
+    PsychicMqttClient &setDnsCache(bool enable = true, uint32_t ttl = 300);
+
+    /**
+     * @brief Discards the cached broker address. The hostname will be resolved again on
+     * the next connection attempt.
+     */
+    void flushDnsCache();
+
     /**
      * @brief Registers a callback function to be called when the MQTT client is connected.
      *
@@ -267,9 +459,13 @@ public:
      * @param qos The QoS level to listen for.
      * @param callback The callback function with the signature void(char *topic,
      * char *payload, int msgId, int retain, int qos, bool dup) to be registered.
+     * @param priority The dispatch class of the handler. With setDispatchQueue(), handlers
+     * of a higher class run before all waiting messages of lower ones. Defaults to
+     * PSYCHIC_MQTT_PRIORITY_NORMAL, the class of onMessage() handlers.
      * @return A reference to the PsychicMqttClient instance.
      */
-    PsychicMqttClient &onTopic(const char *topic, int qos, OnMessageUserCallback callback);
+    PsychicMqttClient &onTopic(const char *topic, int qos, OnMessageUserCallback callback,
+                               PsychicMqttPriority_t priority = PSYCHIC_MQTT_PRIORITY_NORMAL);
 
     /**
      * @brief Registers a callback function to be called when a message is published.
@@ -287,6 +483,57 @@ public:
      */
     PsychicMqttClient &onError(OnErrorUserCallback callback);
 
+    /**
+     * @brief Registers a callback function to be called once a connection attempt has
+     * completed. This is after MQTT_EVENT_CONNECTED and all onTopic() subscriptions have
+     * been acknowledged by the server.
+     *
+     * @param callback The callback function with the signature
+     * void(const PsychicMqttConnectStats_t &stats) to be registered.
+     * @return A reference to the PsychicMqttClient instance.
+     */
+    PsychicMqttClient &onConnectStats(OnConnectStatsUserCallback callback);
+
+    /**
+     * @brief Registers a callback function to be called when an event handler exceeded
+     * the execution time budget set with setHandlerBudget(). The callback runs right after
+     * the slow handler returned, in the same task: the MQTT task, or the dispatch task for
+     * message handlers once setDispatchQueue() is enabled.
+     *
+     * @param callback The callback function with the signature void(uint32_t handle,
+     * uint32_t micros) to be registered.
+     * @return A reference to the PsychicMqttClient instance.
+     */
+    PsychicMqttClient &onSlowHandler(OnSlowHandlerUserCallback callback);
+
+    /**
+     * @brief Removes all onTopic() handlers of a topic filter and unsubscribes from it.
+     * Safe to call from any task, including from inside a callback.
+     *
+     * @param topic The topic filter as passed to onTopic().
+     * @return A reference to the PsychicMqttClient instance.
+     */
+    PsychicMqttClient &removeTopic(const char *topic);
+
+    /**
+     * @brief Removes a single event handler. The handle is assigned in registration order
+     * starting at 0 and reported by getHandlerProfiles(). Removing the last onTopic()
+     * handler of a topic filter unsubscribes from it. Safe to call from any task,
+     * including from inside a callback.
+     *
+     * @param handle The handle of the handler.
+     * @return True if a handler was removed.
+     */
+    bool removeHandler(uint32_t handle);
+
+    /**
+     * @brief Sets the execution time budget for a single event handler invocation.
+     *
+     * @param micros The budget in microseconds. 0 disables the check. Defaults to 0.
+     * @return A reference to the PsychicMqttClient instance.
+     */
+    PsychicMqttClient &setHandlerBudget(uint32_t micros = 0);
+
     /**
      * @brief Checks if the MQTT client is connected.
      *
@@ -295,18 +542,59 @@ public:
     bool connected();
 
     /**
-     * @brief Connects the MQTT client to the server.
+     * @brief Returns the current connection state. The state is updated from the MQTT task
+     * and can be read from any task.
+     *
+     * @return The connection state.
+     */
+    PsychicMqttState_t state();
+
+    /**
+     * @brief Blocks the calling task until the client reaches a connection state. The task
+     * sleeps on an event group instead of polling. Must not be called from a callback, as
+     * the MQTT task would wait for itself.
+     *
+     * @param state The state to wait for, e.g. PSYCHIC_MQTT_STATE_CONNECTED.
+     * @param timeoutMs Maximum time to wait in milliseconds. Defaults to forever.
+     * @return True if the state was reached, false on timeout.
+     */
+    bool waitFor(PsychicMqttState_t state, uint32_t timeoutMs = UINT32_MAX);
+
+    /**
+     * @brief Calls a callback once the client is connected, right away if it already is.
+     * The callback runs only once, in the MQTT task when the connection is established. If
+     * the client stops first, e.g. by disconnect(), it is called with false.
+     *
+     * @param callback The callback function with the signature void(bool connected).
+     */
+    void whenConnected(OnceConnectedUserCallback callback);
+
+    /**
+     * @brief Connects the MQTT client to the server. Does nothing while the client is
+     * already connecting or connected, so it is safe to call repeatedly.
      *
      * @note All parameters must be set before calling this method.
      */
     void connect();
 
     /**
-     * @brief Disconnects the MQTT client from the server.
-     * This call might be blocking until the client is stopped cleanly
+     * @brief Disconnects the MQTT client from the server. Messages still waiting for their
+     * acknowledgement are discarded. Blocks until the client is stopped cleanly, but at most
+     * PSYCHIC_MQTT_DISCONNECT_TIMEOUT_MS.
      */
     void disconnect();
 
+    /**
+     * @brief Drains the outbox, then disconnects and stops the client within a deadline,
+     * e.g. before an OTA reboot or deep sleep. New publishes are rejected from the start.
+     * The calling task sleeps until all QoS 1 and 2 messages are acknowledged or the
+     * deadline expired, then the DISCONNECT is sent with the remaining time.
+     *
+     * @param deadlineMs Maximum duration of the whole shutdown in milliseconds.
+     * @return The number of flushed and abandoned messages and the duration.
+     */
+    PsychicMqttShutdownResult_t shutdown(uint32_t deadlineMs);
+
     /**
      * @brief Forcefully stops the MQTT client and disconnects from the server.
      * This does not trigger the onDisconnect callbacks.
@@ -323,6 +611,21 @@ public:
      */
     int subscribe(const char *topic, int qos);
 
+    /**
+     * @brief Subscribes to a topic and calls a completion handler exactly once: on SUBACK,
+     * when the timeout expired, or when the subscription could not be sent.
+     *
+     * @param topic The topic to subscribe to.
+     * @param qos The QoS level for the subscription.
+     * @param onComplete The handler with the signature void(PsychicMqttPublishStatus_t status,
+     * int msgId, uint32_t rtt). Status is PSYCHIC_MQTT_PUBLISH_ACKNOWLEDGED on SUBACK.
+     * @param timeoutMs Time to wait for the SUBACK, 0 waits forever. Defaults to
+     * PSYCHIC_MQTT_PUBLISH_TIMEOUT_MS.
+     * @return Message ID on success, -1 on failure.
+     */
+    int subscribe(const char *topic, int qos, OnPublishCompleteUserCallback onComplete,
+                  uint32_t timeoutMs = PSYCHIC_MQTT_PUBLISH_TIMEOUT_MS);
+
     /**
      * @brief Unsubscribes from a topic. Server must be connected
      * for an unsubscription to succeed.
@@ -342,10 +645,146 @@ public:
      * @param length The length of the payload. Defaults to 0.
      * @param async Whether to enqueue the message for asynchronous publishing.
      * Defaults to true. False means blocking until the message is published.
-     * @return Message ID on success, -1 on failure.
+     * @return Message ID on success, 0 if the message waits for room in the in-flight window,
+     * -1 on failure.
      */
     int publish(const char *topic, int qos, bool retain, const char *payload = nullptr, int length = 0, bool async = true);
 
+    /**
+     * @brief Publishes a message with a priority class. Asynchronous QoS 1 and 2 publishes
+     * beyond the in-flight window wait in a lane per class, higher classes leave first, see
+     * setPriorityWeights(). High priority messages are not held by setBatching(). Without
+     * setInflightWindow() the class has no effect.
+     *
+     * @param topic The topic to publish to.
+     * @param qos The QoS level (0-2) for the message.
+     * @param retain The retain flag for the message.
+     * @param payload The payload for the message.
+     * @param length The length of the payload, 0 takes the string length.
+     * @param priority The priority class of the message.
+     * @param async Whether to enqueue the message for asynchronous publishing. Defaults to true.
+     * @return Message ID on success, 0 if the message waits for room in the in-flight window,
+     * -1 on failure.
+     */
+    int publish(const char *topic, int qos, bool retain, const char *payload, int length,
+                PsychicMqttPriority_t priority, bool async = true);
+
+    /**
+     * @brief Publishes a message to a topic and calls a completion handler exactly once:
+     * on PUBACK for QoS 1 or PUBCOMP for QoS 2, when the timeout expired, or when the
+     * message was rejected or deleted from the outbox. The handler receives the time since
+     * publishing, the round trip for acknowledged messages. QoS 0 messages complete as
+     * sent once handed to the MQTT client. At most PSYCHIC_MQTT_COMPLETION_SLOTS QoS 1 and
+     * 2 messages with a handler can be in flight, further ones are rejected.
+     *
+     * @param topic The topic to publish to.
+     * @param qos The QoS level (0-2) for the message.
+     * @param retain The retain flag for the message.
+     * @param payload The payload for the message.
+     * @param length The length of the payload, 0 takes the string length.
+     * @param onComplete The handler with the signature void(PsychicMqttPublishStatus_t status,
+     * int msgId, uint32_t rtt), rtt in microseconds. Runs in the MQTT task on acknowledgement,
+     * in the esp_timer task on timeout, or in the calling task if the message was rejected.
+     * @param timeoutMs Time to wait for the acknowledgement, 0 waits forever. Defaults to
+     * PSYCHIC_MQTT_PUBLISH_TIMEOUT_MS.
+     * @param async Whether to enqueue the message for asynchronous publishing. Defaults to true.
+     * @return Message ID on success, 0 if the message waits for room in the in-flight window,
+     * -1 on failure.
+     */
+    int publish(const char *topic, int qos, bool retain, const char *payload, int length,
+                OnPublishCompleteUserCallback onComplete, uint32_t timeoutMs = PSYCHIC_MQTT_PUBLISH_TIMEOUT_MS,
+                bool async = true);
+
+    // A lambda without captures converts to bool as well as to std::function, this exact match
+    // keeps publish(topic, qos, retain, payload, length, [](...) {...}) unambiguous
+    template <typename Callback,
+              typename = decltype(std::declval<Callback &>()(PSYCHIC_MQTT_PUBLISH_ACKNOWLEDGED, 0, 0u))>
+    int publish(const char *topic, int qos, bool retain, const char *payload, int length, Callback onComplete,
+                uint32_t timeoutMs = PSYCHIC_MQTT_PUBLISH_TIMEOUT_MS, bool async = true)
+    {
+        return publish(topic, qos, retain, payload, length, OnPublishCompleteUserCallback(onComplete), timeoutMs, async);
+    }
+
+    /**
+     * @brief Publishes a message right away with high priority, bypassing the batch of
+     * setBatching(). The messages waiting in the batch are sent first, in the same burst.
+     *
+     * @param topic The topic to publish to.
+     * @param qos The QoS level (0-2) for the message.
+     * @param retain The retain flag for the message.
+     * @param payload The payload for the message. Defaults to nullptr.
+     * @param length The length of the payload. Defaults to 0.
+     * @param async Whether to enqueue the message for asynchronous publishing. Defaults to true.
+     * @return Message ID on success, 0 if the message waits for room in the in-flight window,
+     * -1 on failure.
+     */
+    int publishUrgent(const char *topic, int qos, bool retain, const char *payload = nullptr, int length = 0,
+                      bool async = true);
+
+    /**
+     * @brief Publishes a message whose payload is pulled from a producer, e.g. a file or a
+     * camera frame. This does not reduce the peak memory below the payload size: the
+     * payload is read into a single allocation of totalLength bytes and published blocking,
+     * esp-mqtt has no API to write it to the transport piece by piece. It only avoids the
+     * second copy an asynchronous publish() makes in the outbox. A QoS 1 or 2 message
+     * larger than the out buffer is rejected, esp-mqtt would send it in fragments without
+     * an outbox entry, neither retransmitted nor acknowledged. Must not be called from
+     * inside a callback.
+     *
+     * @param topic The topic to publish to.
+     * @param qos The QoS level (0-2) for the message.
+     * @param retain The retain flag for the message.
+     * @param totalLength The length of the payload.
+     * @param producer The function with the signature size_t(uint8_t *buffer, size_t maxLength),
+     * called until totalLength bytes were written. It returns the bytes written, 0 aborts.
+     * @return Message ID on success, -1 on failure or if the producer aborted.
+     */
+    int publishFrom(const char *topic, int qos, bool retain, size_t totalLength, PayloadProducerUserCallback producer);
+
+    /**
+     * @brief Publishes totalLength bytes read from an Arduino Stream, e.g. a File or a
+     * WiFiClient, see the producer version above. Fails if the stream times out.
+     */
+    int publishFrom(const char *topic, int qos, bool retain, size_t totalLength, Stream &stream);
+
+#ifdef PSYCHIC_MQTT_COROUTINES
+    /**
+     * @brief Awaitable publish() for C++20 coroutines. co_await resumes once the message
+     * completed as with the completion handler of publish(), on PUBACK or PUBCOMP for QoS 1
+     * and 2 and right away for QoS 0. The payload is copied before the coroutine suspends.
+     *
+     * @return An awaiter, co_await yields a PsychicMqttAwaitResult_t.
+     */
+    PsychicMqttPublishAwaiter<PsychicMqttClient> publishAsync(const char *topic, int qos, bool retain,
+                                                              const char *payload = nullptr, int length = 0,
+                                                              uint32_t timeoutMs = PSYCHIC_MQTT_PUBLISH_TIMEOUT_MS)
+    {
+        return PsychicMqttPublishAwaiter<PsychicMqttClient>(*this, topic, qos, retain, payload, length, timeoutMs);
+    }
+
+    /**
+     * @brief Awaitable subscribe() for C++20 coroutines. co_await resumes on SUBACK.
+     *
+     * @return An awaiter, co_await yields a PsychicMqttAwaitResult_t.
+     */
+    PsychicMqttSubscribeAwaiter<PsychicMqttClient> subscribeAsync(const char *topic, int qos = 0,
+                                                                  uint32_t timeoutMs = PSYCHIC_MQTT_PUBLISH_TIMEOUT_MS)
+    {
+        return PsychicMqttSubscribeAwaiter<PsychicMqttClient>(*this, topic, qos, timeoutMs);
+    }
+
+    /**
+     * @brief Awaitable whenConnected() for C++20 coroutines. co_await resumes once the client
+     * is connected, without suspending if it already is.
+     *
+     * @return An awaiter, co_await yields false if the client stopped instead.
+     */
+    PsychicMqttConnectedAwaiter<PsychicMqttClient> connectedAsync()
+    {
+        return PsychicMqttConnectedAwaiter<PsychicMqttClient>(*this);
+    }
+#endif
+
     /**
      * @brief Gets the client ID of the MQTT client.
      *
@@ -361,27 +800,513 @@ public:
      */
     esp_mqtt_client_config_t *getMqttConfig();
 
+    /**
+     * @brief Returns the timing breakdown of the connection attempts. The TCP connect and
+     * the TLS handshake are reported together with the CONNACK as the ESP-IDF MQTT client
+     * does not report when the transport is established. DNS is only broken out with
+     * setDnsCache(), otherwise it is part of the connect phase.
+     *
+     * @return A copy of the connection statistics.
+     */
+    PsychicMqttConnectStats_t getConnectStats();
+
+    /**
+     * @brief Returns a snapshot of the message path counters. The counters are updated
+     * lock-free and can stay enabled in production. All counters wrap around at 2^32.
+     *
+     * @return A copy of the message statistics.
+     */
+    PsychicMqttStats_t stats();
+
+    /**
+     * @brief Resets all message path counters to zero.
+     */
+    void resetStats();
+
+    /**
+     * @brief Periodically publishes the message statistics as JSON to a topic.
+     *
+     * @param topic The topic to publish the statistics to, e.g. "$SYS/esp32/stats".
+     * nullptr stops publishing.
+     * @param interval The publish interval in milliseconds. Defaults to 60000.
+     * @return A reference to the PsychicMqttClient instance.
+     */
+    PsychicMqttClient &setStatsTopic(const char *topic, uint32_t interval = 60000);
+
+    /**
+     * @brief Returns the execution profile of all registered event handlers. Every
+     * invocation is timed with esp_timer_get_time(). The 99th percentile is estimated
+     * from a histogram with two buckets per power of two.
+     *
+     * @return The profiles of all handlers in registration order.
+     */
+    std::vector<PsychicMqttHandlerProfile_t> getHandlerProfiles();
+
+    /**
+     * @brief Enables the binary trace ring. Every event on the hot paths is recorded with
+     * its msg_id, topic hash, payload length and a timestamp, without any printf formatting.
+     * Call before connect().
+     *
+     * @param records Capacity of the ring, rounded up to the next power of two. 0 disables
+     * tracing and frees the ring. Defaults to 256.
+     * @return A reference to the PsychicMqttClient instance.
+     */
+    PsychicMqttClient &setTrace(size_t records = 256);
+
+    /**
+     * @brief Copies the recorded trace from oldest to newest.
+     *
+     * @param records Destination array.
+     * @param maxRecords Size of the destination array.
+     * @return The number of records copied.
+     */
+    size_t readTrace(PsychicMqttTraceRecord_t *records, size_t maxRecords);
+
+    /**
+     * @brief Prints the recorded trace as text, e.g. to Serial.
+     *
+     * @param output The Print instance to write to.
+     */
+    void dumpTrace(Print &output);
+
+    /**
+     * @brief Returns the hash of a topic as stored in the trace records.
+     *
+     * @param topic The topic to hash.
+     * @return The FNV-1a hash of the topic.
+     */
+    static uint32_t topicHash(const char *topic);
+
+    /**
+     * @brief Records every raw MQTT event to a compact binary stream, e.g. a file on SD
+     * card. The recording can be fed back with PsychicMqttReplay. Events are written from
+     * the MQTT task, a slow output delays the dispatch of all events.
+     *
+     * @param output The Print instance to write the recording to, nullptr stops recording.
+     * @return A reference to the PsychicMqttClient instance.
+     */
+    PsychicMqttClient &setEventRecorder(Print *output);
+
+    /**
+     * @brief Enables congestion-aware admission control for asynchronous publishes. The
+     * admitted rate starts at maxRate and adapts to the link: each acknowledgement raises it
+     * slowly, a publish to acknowledgement time well above the observed minimum or an outbox
+     * above outboxLimit halves it. Rejected publishes return -1 and are passed to the
+     * onPublishRejected() callbacks. Blocking publishes are not limited. Call before connect().
+     *
+     * @param maxRate Maximum publishes per second, 0 disables rate control.
+     * @param minRate Minimum publishes per second. Defaults to 1.
+     * @param outboxLimit Outbox size in bytes considered congested. Defaults to 16384.
+     * @return A reference to the PsychicMqttClient instance.
+     */
+    PsychicMqttClient &setRateControl(uint32_t maxRate, uint32_t minRate = 1, size_t outboxLimit = 16384);
+
+    /**
+     * @brief Limits the asynchronous publishes to topics matching a filter with a token
+     * bucket, on top of the shared rate. The first matching budget applies, set budgets for
+     * specific filters before general ones. Requires setRateControl().
+     *
+     * @param filter The topic filter, MQTT wildcards are supported.
+     * @param rate Publishes per second, 0 removes the budget.
+     * @param burst Publishes admitted at once after an idle period, 0 takes the rate.
+     * @return A reference to the PsychicMqttClient instance.
+     */
+    PsychicMqttClient &setTopicBudget(const char *filter, uint32_t rate, uint32_t burst = 0);
+
+    /**
+     * @brief Registers a callback function to be called when rate control rejected a publish.
+     * The callback runs in the publishing task. It may store the message and publish it
+     * later, publishing it right away would be rejected again.
+     *
+     * @param callback The callback function with the signature void(const char *topic,
+     * const char *payload, int length, int qos, bool retain) to be registered.
+     * @return A reference to the PsychicMqttClient instance.
+     */
+    PsychicMqttClient &onPublishRejected(OnPublishRejectedUserCallback callback);
+
+    /**
+     * @brief Returns the state of the rate control.
+     *
+     * @return The admitted rate, round trip times and counters, all zero if rate control is disabled.
+     */
+    PsychicMqttRateStats_t rateStats();
+
+    /**
+     * @brief Bounds the QoS 1 and 2 messages waiting for their acknowledgement. Asynchronous
+     * publishes beyond the window are copied to a local queue and handed to the MQTT client
+     * in order as acknowledgements arrive, those publishes return 0 instead of a msg_id. A
+     * completion handler passed to publish() also covers the time in the queue, its timeout
+     * starts once the message leaves the queue. Blocking publishes are not queued, but count
+     * towards the window. Call before connect().
+     *
+     * @param maxMessages Maximum unacknowledged messages, 0 disables the window and hands
+     * queued messages to the MQTT client right away.
+     * @param maxBytes Maximum outbox size in bytes, a single message is always admitted. 0
+     * does not limit the bytes. Defaults to 0.
+     * @param queueLimit Maximum bytes of each of the PSYCHIC_MQTT_PRIORITY_LANES priority lanes
+     * of the local queue, so the whole queue holds up to three times as much. Publishes that do
+     * not fit their lane return -1. Defaults to 16384.
+     * @return A reference to the PsychicMqttClient instance.
+     */
+    PsychicMqttClient &setInflightWindow(uint32_t maxMessages, size_t maxBytes = 0, size_t queueLimit = 16384);
+
+    /**
+     * @brief Returns the number of publishes waiting in the local queue of the in-flight window.
+     *
+     * @return The number of queued messages, 0 if the window is disabled.
+     */
+    size_t queuedMessages();
+
+    /**
+     * @brief Sets how many messages each priority lane of the in-flight window may send per
+     * round while several lanes are waiting. Higher lanes are served first in every round,
+     * lower ones still get their share. Defaults to PSYCHIC_MQTT_PRIORITY_WEIGHTS, 8, 4 and 1.
+     * Requires setInflightWindow().
+     *
+     * @param high Messages per round of the high priority lane, 0 is taken as 1.
+     * @param normal Messages per round of the normal priority lane, 0 is taken as 1.
+     * @param low Messages per round of the low priority lane, 0 is taken as 1.
+     * @return A reference to the PsychicMqttClient instance.
+     */
+    PsychicMqttClient &setPriorityWeights(uint32_t high, uint32_t normal, uint32_t low);
+
+    /**
+     * @brief Dispatches received messages from a separate task instead of the MQTT task.
+     * Messages are copied into a queue per dispatch class of onTopic() and the classes are
+     * drained with strict priority, so commands are handled ahead of a burst of telemetry.
+     * A message matching handlers of several classes is queued once per class. The
+     * retained cache, the duplicate filter and call() responses are still handled in the
+     * MQTT task. Call before connect(), not from a handler.
+     *
+     * @param limit Maximum bytes of the waiting messages per class, messages beyond are
+     * dropped. 0 stops the dispatch task and dispatches from the MQTT task again. Defaults
+     * to 16384.
+     * @param stackSize Stack of the dispatch task in bytes. Defaults to 4096.
+     * @param taskPriority FreeRTOS priority of the dispatch task. Defaults to 5, the
+     * priority of the MQTT task.
+     * @return A reference to the PsychicMqttClient instance.
+     */
+    PsychicMqttClient &setDispatchQueue(size_t limit = 16384, uint32_t stackSize = 4096, UBaseType_t taskPriority = 5);
+
+    /**
+     * @brief Returns the depth and waiting time per dispatch class.
+     *
+     * @return The dispatch statistics, all zero if the dispatch queue is disabled.
+     */
+    PsychicMqttDispatchStats_t dispatchStats();
+
+    /**
+     * @brief Holds asynchronous publishes and sends them in bursts, so the radio of a device
+     * in modem sleep wakes once per burst instead of once per message. A burst leaves when
+     * the oldest message waited latencyMs, when the buffer is full, or with publishUrgent().
+     * Batched publishes return 0 instead of a msg_id, the timeout of a completion handler
+     * starts once the message leaves the batch. Blocking publishes are not batched. Call
+     * before connect().
+     *
+     * @param latencyMs Longest time a message is held, 0 sends the held messages and disables
+     * batching.
+     * @param bufferLimit Maximum bytes of the held messages, a message beyond sends the burst
+     * early. Defaults to 4096.
+     * @return A reference to the PsychicMqttClient instance.
+     */
+    PsychicMqttClient &setBatching(uint32_t latencyMs, size_t bufferLimit = 4096);
+
+    /**
+     * @brief Sends the messages held by setBatching() right away.
+     */
+    void flushBatch();
+
+    /**
+     * @brief Returns the bursts sent and the estimated radio-on time saved by batching.
+     *
+     * @return The batching statistics, all zero if batching is disabled.
+     */
+    PsychicMqttBatchStats_t batchStats();
+
+    /**
+     * @brief Drops redelivered QoS 1 messages that were already received within a time
+     * window, before they are dispatched to any handler. Messages are identified by packet
+     * identifier, topic and payload, only those with the DUP flag set are dropped. QoS 2 is
+     * delivered exactly once by the broker and not filtered. A connect without a session
+     * present clears the filter. The filter holds a fixed number of fingerprints, at higher
+     * message rates the window is shortened accordingly. Suppressed messages are counted in
+     * stats(). Call before connect().
+     *
+     * @param windowMs Time a message is remembered in milliseconds, 0 disables the filter.
+     * Defaults to 30000.
+     * @param entries Number of remembered messages, 8 bytes each. Defaults to 64.
+     * @return A reference to the PsychicMqttClient instance.
+     */
+    PsychicMqttClient &setDuplicateFilter(uint32_t windowMs = 30000, size_t entries = 64);
+
+    /**
+     * @brief Enables the local cache of retained messages. Every received message with the
+     * retain flag is stored by topic, later messages on a cached topic replace it and an
+     * empty payload removes it. Once the budget is exceeded, the least recently used topics
+     * are evicted. An onTopic() handler registered for a filter that is already subscribed
+     * is served from the cache instead of subscribing again. Call before connect().
+     *
+     * @param budget Maximum memory of the cache in bytes, 0 disables the cache and frees it.
+     * Defaults to 16384.
+     * @return A reference to the PsychicMqttClient instance.
+     */
+    PsychicMqttClient &setRetainedCache(size_t budget = 16384);
+
+    /**
+     * @brief Looks up the latest retained message of a topic in the cache.
+     *
+     * @param topic The topic, without wildcards.
+     * @param view Receives the message. The view keeps the message alive, it stays valid
+     * after the topic was updated or evicted.
+     * @return True if the topic is cached.
+     */
+    bool getRetained(const char *topic, PsychicMqttRetainedView &view);
+
+    /**
+     * @brief Calls a function for every cached retained message matching a topic filter,
+     * from most to least recently used. The callback runs in the calling task.
+     *
+     * @param filter The topic filter, MQTT wildcards are supported. nullptr matches all topics.
+     * @param callback The function with the signature void(const PsychicMqttRetainedView &view).
+     * @return The number of matching messages.
+     */
+    size_t forEachRetained(const char *filter, OnRetainedUserCallback callback);
+
+    /**
+     * @brief Returns the size and hit rate of the retained cache.
+     *
+     * @return The cache statistics, all zero if the cache is disabled.
+     */
+    PsychicMqttRetainedStats_t retainedStats();
+
+    /**
+     * @brief Enables request/response calls with call() and callSync(). Responses are
+     * routed through a single subscription to <responseTopic>/+ with QoS 1, which is made
+     * on every connect. Reconfiguring cancels all pending calls. Call before connect().
+     *
+     * @param responseTopic Base of the response topics, unique to this client, e.g.
+     * "devices/<id>/rpc". nullptr disables calls.
+     * @param maxInFlight Maximum number of calls pending at the same time. Defaults to 16.
+     * @return A reference to the PsychicMqttClient instance.
+     */
+    PsychicMqttClient &setRpc(const char *responseTopic, size_t maxInFlight = 16);
+
+    /**
+     * @brief Publishes a request and completes the callback with the response, after the
+     * timeout or as failed if the request could not be published. Any number of calls up
+     * to maxInFlight may be pending at the same time, responses may arrive in any order.
+     * The callback runs exactly once, in the MQTT task for responses, in the esp_timer
+     * task for timeouts, or in the calling task if the call failed right away.
+     *
+     * @param topic The topic the serving side listens on, see onRpc().
+     * @param payload The request body.
+     * @param callback The function with the signature void(PsychicMqttRpcStatus_t status,
+     * const char *payload, int length). The payload is nullptr unless the status is
+     * PSYCHIC_MQTT_RPC_OK.
+     * @param timeoutMs The time to wait for the response. Defaults to 5000.
+     * @param qos The QoS level of the request. Defaults to 1.
+     * @param length The length of the body, 0 takes the string length.
+     * @return The correlation ID of the call, 0 if it failed right away.
+     */
+    uint32_t call(const char *topic, const char *payload, OnRpcResponseUserCallback callback,
+                  uint32_t timeoutMs = 5000, int qos = 1, int length = 0);
+
+    /**
+     * @brief Publishes a request and blocks the calling task until the response arrived or
+     * the timeout expired. Must not be called from inside a callback, the response would be
+     * dispatched by the blocked MQTT task.
+     *
+     * @param topic The topic the serving side listens on, see onRpc().
+     * @param payload The request body.
+     * @param response Receives the response if the status is PSYCHIC_MQTT_RPC_OK.
+     * @param timeoutMs The time to wait for the response. Defaults to 5000.
+     * @param qos The QoS level of the request. Defaults to 1.
+     * @param length The length of the body, 0 takes the string length.
+     * @return The completion status of the call.
+     */
+    PsychicMqttRpcStatus_t callSync(const char *topic, const char *payload, String &response,
+                                    uint32_t timeoutMs = 5000, int qos = 1, int length = 0);
+
+    /**
+     * @brief Serves requests made with call() on a topic. The returned String is published
+     * to the response topic of the request. Requests without a response topic are ignored.
+     *
+     * @param topic The topic to serve, MQTT wildcards are supported.
+     * @param handler The function with the signature String(const char *topic,
+     * const char *payload, int length), running in the MQTT task or in the dispatch task
+     * of setDispatchQueue().
+     * @param qos The QoS level of the subscription and the responses. Defaults to 1.
+     * @return A reference to the PsychicMqttClient instance.
+     */
+    PsychicMqttClient &onRpc(const char *topic, OnRpcRequestUserCallback handler, int qos = 1);
+
 private:
+    friend class PsychicMqttReplay;
+
     esp_mqtt_client_handle_t _client = nullptr;
     esp_mqtt_client_config_t _mqtt_cfg;
     esp_mqtt_error_codes_t _lastError;
-    bool _connected = false;
-    bool _stopMqttClient = false;
+
+    // Connection state machine, every state has a bit in _stateEvents
+    std::atomic<PsychicMqttState_t> _state{PSYCHIC_MQTT_STATE_IDLE};
+    EventGroupHandle_t _stateEvents = nullptr;
+    bool _eventHandlerRegistered = false;
+    bool _started = false; // esp-mqtt task is running
+
+    void _setState(PsychicMqttState_t state);
+    bool _autoReconnect();
+    void _stop(int64_t deadline);
+
+    // QoS 1 and 2 messages waiting for their acknowledgement
+    std::atomic<uint32_t> _inFlight{0};
+    std::atomic<bool> _draining{false};
+    std::atomic<uint32_t> _drainFlushed{0};
+    SemaphoreHandle_t _drainSemaphore = nullptr;
+
+    void _messageSettled(bool acknowledged);
+    void _reconcileInFlight();
+
+    // Callbacks of whenConnected(), released on CONNECTED or STOPPED
+    std::vector<OnceConnectedUserCallback> _connectWaiters;
+    SemaphoreHandle_t _connectWaitersLock = nullptr;
+
+    void _releaseConnectWaiters(bool connected);
+
+    // In-flight window, publishes beyond it wait in _queue
+    uint32_t _windowMessages = 0;
+    size_t _windowBytes = 0;
+    PsychicMqttLanes *_queue = nullptr;
+    std::atomic<uint32_t> _releaseRequests{0};
+
+    bool _acquireWindow(int length);
+    void _releaseQueued();
+
+    // Batching, held publishes leave when _batchTimer fires
+    PsychicMqttBatch *_batch = nullptr;
+    esp_timer_handle_t _batchTimer = nullptr;
+    std::atomic<uint32_t> _flushRequests{0};
+
+    static void _flushBatchStatic(void *arg);
 
     char *_buffer = nullptr;
     char *_topic = nullptr;
 
+    // DNS cache
+    bool _dnsCacheEnabled = false;
+    uint32_t _dnsCacheTtl = 300;
+    char *_dnsHost = nullptr;
+    char *_pinnedUri = nullptr;
+    char _dnsAddress[48] = {0};
+    int64_t _dnsResolvedAt = 0;
+    bool _dnsAttemptPending = false;
+
+    // Connection attempt timing
+    PsychicMqttConnectStats_t _connectStats = {};
+    portMUX_TYPE _connectStatsMux = portMUX_INITIALIZER_UNLOCKED;
+    int64_t _attemptStartedAt = 0;
+    int64_t _attemptConnectedAt = 0;
+    uint32_t _attemptDns = 0;
+    std::vector<int> _resubscribeMsgIds;
+
+    void _finishConnectAttempt();
+
+    // Message path counters
+    struct
+    {
+        std::atomic<uint32_t> messagesIn[3];
+        std::atomic<uint32_t> bytesIn[3];
+        std::atomic<uint32_t> messagesOut[3];
+        std::atomic<uint32_t> bytesOut[3];
+        std::atomic<uint32_t> multipartReassemblies;
+        std::atomic<uint32_t> droppedPublishes;
+        std::atomic<uint32_t> suppressedDuplicates;
+        std::atomic<uint32_t> queuedPublishes;
+        std::atomic<uint32_t> subscribes;
+        std::atomic<uint32_t> unsubscribes;
+        std::atomic<uint32_t> reconnects;
+        std::atomic<uint32_t> dispatchHistogram[PSYCHIC_MQTT_HISTOGRAM_BUCKETS];
+    } _stats = {};
+    bool _wasConnected = false;
+    char *_statsTopic = nullptr;
+    SemaphoreHandle_t _statsTopicLock = nullptr; // guards _statsTopic against the timer callback
+    esp_timer_handle_t _statsTimer = nullptr;
+
+    static void _publishStatsStatic(void *arg);
+    void _publishStats();
+    void _dispatchMessage(char *topic, char *payload, int length, int msgId, int retain, int qos, bool dup);
+    void _runHandlers(char *topic, char *payload, int retain, int qos, bool dup, int priority);
+
+    PsychicMqttDispatcher *_dispatcher = nullptr;
+
+    PsychicMqttTrace *_trace = nullptr;
+
+    inline void _traceRecord(PsychicMqttTraceEvent_t event, int msgId = 0, uint32_t topicHash = 0, uint32_t length = 0,
+                             int qos = 0)
+    {
+        if (_trace != nullptr)
+            _trace->record(event, msgId, topicHash, length, qos);
+    }
+
+    Print *_recorder = nullptr;
+    int64_t _recorderLastEvent = 0;
+
+    PsychicMqttRetainedCache *_retained = nullptr;
+
+    void _serveRetained(const std::shared_ptr<OnMessageUserCallback_t> &subscription);
+
+    PsychicMqttRpc *_rpc = nullptr;
+
+    PsychicMqttDedup *_dedup = nullptr;
+
+    PsychicMqttRateControl *_rateControl = nullptr;
+
+    PsychicMqttKeepAlive *_keepAlive = nullptr;
+    char *_probeTopic = nullptr;
+    std::atomic<int> _probesLeft{0};
+    std::atomic<int64_t> _lastTrafficAt{0}; // last event or publish, an idle connection has neither
+    bool _transportFailed = false;          // transport error on the current connection, MQTT task only
+
+    void _sendProbe();
+
+    PsychicMqttCompletion _completion;
+    PsychicMqttCompletion _subscribeCompletion;
+
+    int _publish(const char *topic, int qos, bool retain, const char *payload, int length, bool async,
+                 const OnPublishCompleteUserCallback *onComplete, uint32_t timeoutMs, bool urgent = false,
+                 PsychicMqttPriority_t priority = PSYCHIC_MQTT_PRIORITY_NORMAL);
+    int _submit(const char *topic, int qos, bool retain, const char *payload, int length, bool async,
+                const OnPublishCompleteUserCallback *onComplete, uint32_t timeoutMs, PsychicMqttPriority_t priority);
+    bool _fragmented(const char *topic, int qos, int length);
+    int _send(const char *topic, int qos, bool retain, const char *payload, int length, bool async,
+              const OnPublishCompleteUserCallback *onComplete, uint32_t timeoutMs, bool counted);
+
+    // Handler profiling
+    std::atomic<uint32_t> _nextHandle{0};
+    uint32_t _handlerBudget = 0;
+    portMUX_TYPE _profileMux = portMUX_INITIALIZER_UNLOCKED;
+
+    void _recordHandlerTime(PsychicMqttHandlerTiming_t &timing, int64_t start);
+    PsychicMqttHandlerTiming_t _newHandlerTiming();
+
+    void _setupDnsCache(const char *uri);
+    void _pinBrokerAddress(esp_mqtt_client_handle_t client);
+    bool _resolveBrokerAddress();
+
     static void _onMqttEventStatic(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data);
     void _onMqttEvent(esp_event_base_t base, int32_t event_id, void *event_data);
     bool _isTopicMatch(const char *topic, const char *subscription);
 
-    std::vector<OnConnectUserCallback> _onConnectUserCallbacks;
-    std::vector<OnDisconnectUserCallback> _onDisconnectUserCallbacks;
-    std::vector<OnSubscribeUserCallback> _onSubscribeUserCallbacks;
-    std::vector<OnUnsubscribeUserCallback> _onUnsubscribeUserCallbacks;
-    std::vector<OnMessageUserCallback_t> _onMessageUserCallbacks;
-    std::vector<OnPublishUserCallback> _onPublishUserCallbacks;
-    std::vector<OnErrorUserCallback> _onErrorUserCallbacks;
+    // Registration and removal from any task, dispatch iterates a lock-free snapshot
+    PsychicMqttRegistry<PsychicMqttHandler_t<OnConnectUserCallback>> _onConnectUserCallbacks;
+    PsychicMqttRegistry<PsychicMqttHandler_t<OnDisconnectUserCallback>> _onDisconnectUserCallbacks;
+    PsychicMqttRegistry<PsychicMqttHandler_t<OnSubscribeUserCallback>> _onSubscribeUserCallbacks;
+    PsychicMqttRegistry<PsychicMqttHandler_t<OnUnsubscribeUserCallback>> _onUnsubscribeUserCallbacks;
+    PsychicMqttRegistry<OnMessageUserCallback_t> _onMessageUserCallbacks;
+    PsychicMqttRegistry<PsychicMqttHandler_t<OnPublishUserCallback>> _onPublishUserCallbacks;
+    PsychicMqttRegistry<PsychicMqttHandler_t<OnErrorUserCallback>> _onErrorUserCallbacks;
+    PsychicMqttRegistry<OnConnectStatsUserCallback> _onConnectStatsUserCallbacks;
+    PsychicMqttRegistry<OnSlowHandlerUserCallback> _onSlowHandlerUserCallbacks;
+    PsychicMqttRegistry<OnPublishRejectedUserCallback> _onPublishRejectedUserCallbacks;
 
     void _onBeforeConnect(esp_mqtt_event_handle_t &event_data, esp_mqtt_client_handle_t &client);
     void _onConnect(esp_mqtt_event_handle_t &event_data);
@@ -0,0 +1,240 @@
+#include "PsychicMqttCompletion.h"
+
+#include <utility>
+
+#define SLOT_MASK (PSYCHIC_MQTT_COMPLETION_SLOTS - 1)
+
+static_assert((PSYCHIC_MQTT_COMPLETION_SLOTS & SLOT_MASK) == 0, "PSYCHIC_MQTT_COMPLETION_SLOTS must be a power of two");
+
+PsychicMqttCompletion::PsychicMqttCompletion()
+{
+    for (auto &slot : _slots)
+        slot.msgId = 0;
+    for (auto &bucket : _histogram)
+        bucket.store(0);
+    _lock = xSemaphoreCreateMutex();
+}
+
+PsychicMqttCompletion::~PsychicMqttCompletion()
+{
+    if (_timer != nullptr)
+    {
+        esp_timer_stop(_timer);
+        esp_timer_delete(_timer);
+    }
+
+    int64_t now = esp_timer_get_time();
+    for (auto &slot : _slots)
+    {
+        if (slot.msgId != 0)
+            slot.callback(PSYCHIC_MQTT_PUBLISH_DROPPED, slot.msgId, now - slot.sentAt);
+    }
+    vSemaphoreDelete(_lock);
+}
+
+bool PsychicMqttCompletion::reserve()
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    bool reserved = _used < PSYCHIC_MQTT_COMPLETION_SLOTS;
+    if (reserved)
+    {
+        _used++;
+        _reserved++;
+    }
+    xSemaphoreGive(_lock);
+    return reserved;
+}
+
+void PsychicMqttCompletion::release()
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    _used--;
+    _reserved--;
+    xSemaphoreGive(_lock);
+}
+
+void PsychicMqttCompletion::add(int msgId, int64_t sentAt, uint32_t timeoutMs,
+                                const OnPublishCompleteUserCallback &callback)
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    _reserved--;
+
+    for (auto &early : _early)
+    {
+        if (early.msgId == msgId && early.at >= sentAt)
+        {
+            // The MQTT task was faster than the publishing task
+            early.msgId = 0;
+            _used--;
+            xSemaphoreGive(_lock);
+            uint32_t rtt = early.at - sentAt;
+            if (early.status == PSYCHIC_MQTT_PUBLISH_ACKNOWLEDGED)
+                _record(rtt);
+            callback(early.status, msgId, rtt);
+            return;
+        }
+    }
+
+    size_t index = msgId & SLOT_MASK;
+    while (_slots[index].msgId != 0)
+        index = (index + 1) & SLOT_MASK;
+    Slot &slot = _slots[index];
+    slot.msgId = msgId;
+    slot.sentAt = sentAt;
+    slot.deadline = timeoutMs > 0 ? sentAt + (int64_t)timeoutMs * 1000 : INT64_MAX;
+    slot.callback = callback;
+
+    if (timeoutMs > 0)
+    {
+        if (_timer == nullptr)
+        {
+            esp_timer_create_args_t timerArgs = {};
+            timerArgs.callback = _onTimeoutStatic;
+            timerArgs.arg = this;
+            timerArgs.name = "mqtt_complete";
+            esp_timer_create(&timerArgs, &_timer);
+        }
+        _arm();
+    }
+    xSemaphoreGive(_lock);
+}
+
+void PsychicMqttCompletion::complete(int msgId, PsychicMqttPublishStatus_t status)
+{
+    int64_t now = esp_timer_get_time();
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    size_t index = _find(msgId);
+    if (index == PSYCHIC_MQTT_COMPLETION_SLOTS)
+    {
+        // Only kept while a publishing task may still add the entry
+        if (_reserved > 0)
+        {
+            _early[_nextEarly] = {msgId, now, status};
+            _nextEarly = (_nextEarly + 1) % PSYCHIC_MQTT_COMPLETION_EARLY;
+        }
+        xSemaphoreGive(_lock);
+        return;
+    }
+    OnPublishCompleteUserCallback callback = std::move(_slots[index].callback);
+    uint32_t rtt = now - _slots[index].sentAt;
+    _erase(index);
+    _used--;
+    xSemaphoreGive(_lock);
+
+    if (status == PSYCHIC_MQTT_PUBLISH_ACKNOWLEDGED)
+        _record(rtt);
+    callback(status, msgId, rtt);
+}
+
+void PsychicMqttCompletion::histogram(uint32_t *buckets)
+{
+    for (int i = 0; i < PSYCHIC_MQTT_RTT_BUCKETS; i++)
+        buckets[i] = _histogram[i].load(std::memory_order_relaxed);
+}
+
+void PsychicMqttCompletion::resetHistogram()
+{
+    for (auto &bucket : _histogram)
+        bucket.store(0, std::memory_order_relaxed);
+}
+
+size_t PsychicMqttCompletion::_find(int msgId)
+{
+    size_t index = msgId & SLOT_MASK;
+    for (size_t probes = 0; probes < PSYCHIC_MQTT_COMPLETION_SLOTS; probes++)
+    {
+        if (_slots[index].msgId == msgId)
+            return index;
+        if (_slots[index].msgId == 0)
+            break;
+        index = (index + 1) & SLOT_MASK;
+    }
+    return PSYCHIC_MQTT_COMPLETION_SLOTS;
+}
+
+void PsychicMqttCompletion::_erase(size_t index)
+{
+    // Backward shift deletion keeps every probe sequence free of gaps
+    size_t hole = index;
+    size_t next = index;
+    for (size_t probes = 1; probes < PSYCHIC_MQTT_COMPLETION_SLOTS; probes++)
+    {
+        next = (next + 1) & SLOT_MASK;
+        if (_slots[next].msgId == 0)
+            break;
+        size_t home = _slots[next].msgId & SLOT_MASK;
+        bool stays = hole <= next ? (hole < home && home <= next) : (hole < home || home <= next);
+        if (!stays)
+        {
+            _slots[hole] = std::move(_slots[next]);
+            hole = next;
+        }
+    }
+    _slots[hole].msgId = 0;
+    _slots[hole].callback = nullptr;
+}
+
+void PsychicMqttCompletion::_arm()
+{
+    // Called with _lock held. A single one-shot timer tracks the earliest deadline.
+    int64_t earliest = INT64_MAX;
+    for (const auto &slot : _slots)
+    {
+        if (slot.msgId != 0 && slot.deadline < earliest)
+            earliest = slot.deadline;
+    }
+    esp_timer_stop(_timer);
+    if (earliest != INT64_MAX)
+    {
+        int64_t delay = earliest - esp_timer_get_time();
+        esp_timer_start_once(_timer, delay > 0 ? delay : 0);
+    }
+}
+
+void PsychicMqttCompletion::_record(uint32_t rtt)
+{
+    uint32_t ms = rtt / 1000;
+    int bucket = ms == 0 ? 0 : 32 - __builtin_clz(ms);
+    if (bucket >= PSYCHIC_MQTT_RTT_BUCKETS)
+        bucket = PSYCHIC_MQTT_RTT_BUCKETS - 1;
+    _histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void PsychicMqttCompletion::_onTimeoutStatic(void *arg)
+{
+    ((PsychicMqttCompletion *)arg)->_onTimeout();
+}
+
+void PsychicMqttCompletion::_onTimeout()
+{
+    int64_t now = esp_timer_get_time();
+    while (true)
+    {
+        int msgId = 0;
+        uint32_t rtt = 0;
+        OnPublishCompleteUserCallback callback;
+
+        // Erasing shifts entries, so the scan restarts after every expired entry
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        for (size_t i = 0; i < PSYCHIC_MQTT_COMPLETION_SLOTS; i++)
+        {
+            if (_slots[i].msgId != 0 && _slots[i].deadline <= now)
+            {
+                msgId = _slots[i].msgId;
+                rtt = now - _slots[i].sentAt;
+                callback = std::move(_slots[i].callback);
+                _erase(i);
+                _used--;
+                break;
+            }
+        }
+        if (msgId == 0)
+            _arm();
+        xSemaphoreGive(_lock);
+
+        if (msgId == 0)
+            break;
+        callback(PSYCHIC_MQTT_PUBLISH_TIMEOUT, msgId, rtt);
+    }
+}
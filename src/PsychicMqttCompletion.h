@@ -0,0 +1,113 @@
+#pragma once
+/**
+ *   PsychicMqttClient
+ *
+ *   In-flight table of publishes with a completion handler. Entries live in an
+ *   open addressed hash table indexed by msg_id, so the acknowledgement finds
+ *   its handler without a search. Every entry completes exactly once: on
+ *   PUBACK or PUBCOMP with the measured round trip, when its timeout expired
+ *   or when esp-mqtt deleted it from the outbox.
+ *
+ *   The msg_id is only known once esp-mqtt accepted the message, while the
+ *   MQTT task may dispatch the acknowledgement before the publishing task
+ *   added the entry. A slot is therefore reserved before publishing, and
+ *   acknowledgements for unknown msg_ids are kept for a short while as long
+ *   as reservations are outstanding.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#ifndef PSYCHIC_MQTT_COMPLETION_SLOTS
+#define PSYCHIC_MQTT_COMPLETION_SLOTS 32 // publishes with a completion handler in flight, power of two
+#endif
+#define PSYCHIC_MQTT_COMPLETION_EARLY 8 // acknowledgements kept for pending reservations
+#define PSYCHIC_MQTT_RTT_BUCKETS 12     // bucket i counts round trips below 2^i ms, the last one all above
+
+typedef enum
+{
+    PSYCHIC_MQTT_PUBLISH_ACKNOWLEDGED = 0, // PUBACK for QoS 1, PUBCOMP for QoS 2
+    PSYCHIC_MQTT_PUBLISH_SENT,             // QoS 0 message handed to the MQTT client, there is no acknowledgement
+    PSYCHIC_MQTT_PUBLISH_TIMEOUT,          // no acknowledgement within the timeout, the message may still be delivered
+    PSYCHIC_MQTT_PUBLISH_DROPPED,          // rejected, not accepted by the MQTT client or deleted from the outbox
+} PsychicMqttPublishStatus_t;
+
+typedef std::function<void(PsychicMqttPublishStatus_t status, int msgId, uint32_t rtt)> OnPublishCompleteUserCallback;
+
+class PsychicMqttCompletion
+{
+public:
+    PsychicMqttCompletion();
+
+    /**
+     * @brief Completes all pending entries as dropped.
+     */
+    ~PsychicMqttCompletion();
+
+    /**
+     * @brief Reserves a slot before publishing.
+     *
+     * @return False if all slots are in use.
+     */
+    bool reserve();
+
+    /**
+     * @brief Returns a reservation, e.g. when the publish failed.
+     */
+    void release();
+
+    /**
+     * @brief Turns a reservation into an entry, or completes it right away if the
+     * acknowledgement already arrived.
+     *
+     * @param sentAt esp_timer_get_time() before the message was handed to the MQTT client.
+     * @param timeoutMs Timeout in milliseconds, 0 waits forever.
+     */
+    void add(int msgId, int64_t sentAt, uint32_t timeoutMs, const OnPublishCompleteUserCallback &callback);
+
+    /**
+     * @brief Completes the entry of an acknowledged or deleted message.
+     */
+    void complete(int msgId, PsychicMqttPublishStatus_t status);
+
+    void histogram(uint32_t *buckets);
+    void resetHistogram();
+
+private:
+    struct Slot
+    {
+        int msgId; // 0 marks a free slot
+        int64_t sentAt;
+        int64_t deadline;
+        OnPublishCompleteUserCallback callback;
+    };
+
+    struct Early
+    {
+        int msgId;
+        int64_t at;
+        PsychicMqttPublishStatus_t status;
+    };
+
+    Slot _slots[PSYCHIC_MQTT_COMPLETION_SLOTS];
+    Early _early[PSYCHIC_MQTT_COMPLETION_EARLY] = {};
+    size_t _nextEarly = 0;
+    size_t _used = 0;     // entries and reservations
+    size_t _reserved = 0; // reservations not added yet
+    SemaphoreHandle_t _lock;
+    esp_timer_handle_t _timer = nullptr;
+    std::atomic<uint32_t> _histogram[PSYCHIC_MQTT_RTT_BUCKETS];
+
+    size_t _find(int msgId);
+    void _erase(size_t index);
+    void _arm();
+    void _record(uint32_t rtt);
+    static void _onTimeoutStatic(void *arg);
+    void _onTimeout();
+};
@@ -0,0 +1,64 @@
+#include "PsychicMqttDedup.h"
+#include "PsychicMqttTrace.h"
+
+#include <cstring>
+
+#include "esp_timer.h"
+
+PsychicMqttDedup::PsychicMqttDedup(uint32_t windowMs, size_t entries)
+{
+    size_t size = PSYCHIC_MQTT_DEDUP_PROBES;
+    while (size < entries)
+        size <<= 1;
+    _entries = new Entry[size]();
+    _mask = size - 1;
+    _window = windowMs;
+}
+
+PsychicMqttDedup::~PsychicMqttDedup()
+{
+    delete[] _entries;
+}
+
+void PsychicMqttDedup::clear()
+{
+    memset(_entries, 0, (_mask + 1) * sizeof(Entry));
+}
+
+bool PsychicMqttDedup::seen(int msgId, const char *topic, const char *payload, size_t length, bool dup)
+{
+    uint32_t fingerprint = PsychicMqttTrace::hash(topic, strlen(topic));
+    fingerprint ^= PsychicMqttTrace::hash(payload, length) * 0x9e3779b1u;
+    fingerprint ^= (uint32_t)msgId * 0x85ebca6bu;
+    fingerprint ^= fingerprint >> 16;
+    if (fingerprint == 0)
+        fingerprint = 1;
+
+    uint32_t now = esp_timer_get_time() / 1000;
+    Entry *victim = nullptr;
+    uint32_t victimAge = 0;
+    for (size_t i = 0; i < PSYCHIC_MQTT_DEDUP_PROBES; i++)
+    {
+        Entry &entry = _entries[(fingerprint + i) & _mask];
+        // Unsigned arithmetic keeps the age correct across the wrap of the millisecond clock
+        uint32_t age = entry.fingerprint == 0 ? UINT32_MAX : now - entry.seenAt;
+        if (age <= _window && entry.fingerprint == fingerprint)
+        {
+            // Without the DUP flag it is a new message reusing the packet identifier
+            if (dup)
+                return true;
+            entry.seenAt = now;
+            return false;
+        }
+
+        // A free or expired slot, otherwise the oldest fingerprint is replaced
+        if (victim == nullptr || age > victimAge)
+        {
+            victim = &entry;
+            victimAge = age;
+        }
+    }
+    victim->fingerprint = fingerprint;
+    victim->seenAt = now;
+    return false;
+}
@@ -0,0 +1,62 @@
+#pragma once
+/**
+ *   PsychicMqttClient
+ *
+ *   Duplicate filter for received QoS 1 messages. A redelivery after a
+ *   reconnect carries the DUP flag and the same packet identifier, topic and
+ *   payload as the original, so the three are reduced to a 32 bit fingerprint
+ *   and kept in a fixed size hash set for the length of the window. Every
+ *   message is remembered, but only one with the DUP flag is suppressed: a new
+ *   message may reuse the packet identifier, topic and payload of an earlier
+ *   one. Memory is allocated once and does not grow with the message rate: at
+ *   high rates the oldest fingerprints are replaced before their window
+ *   expired.
+ *
+ *   Only used from the MQTT task, not thread safe.
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+#define PSYCHIC_MQTT_DEDUP_PROBES 4 // slots searched per fingerprint
+
+class PsychicMqttDedup
+{
+public:
+    /**
+     * @brief Creates an empty filter.
+     *
+     * @param windowMs Time a message is remembered in milliseconds.
+     * @param entries Number of fingerprints, rounded up to a power of two.
+     */
+    PsychicMqttDedup(uint32_t windowMs, size_t entries);
+    ~PsychicMqttDedup();
+
+    /**
+     * @brief Remembers a message and checks whether it is a redelivery of one seen within
+     * the window.
+     *
+     * @param dup The DUP flag of the message, only a redelivery may be a duplicate.
+     * @return True if the message is a duplicate.
+     */
+    bool seen(int msgId, const char *topic, const char *payload, size_t length, bool dup);
+
+    /**
+     * @brief Forgets all messages, e.g. when a new session restarts the packet identifiers.
+     */
+    void clear();
+
+    uint32_t window() const { return _window; }
+    size_t entries() const { return _mask + 1; }
+
+private:
+    struct Entry
+    {
+        uint32_t fingerprint; // 0 marks an empty slot
+        uint32_t seenAt;      // milliseconds
+    };
+
+    Entry *_entries;
+    size_t _mask;
+    uint32_t _window;
+};
@@ -0,0 +1,153 @@
+#include "PsychicMqttDispatcher.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include "esp_timer.h"
+
+PsychicMqttDispatcher::PsychicMqttDispatcher(size_t limit, Handler handler, uint32_t stackSize,
+                                             UBaseType_t taskPriority)
+    : _handler(handler), _limit(limit)
+{
+    _lock = xSemaphoreCreateMutex();
+    _wakeup = xSemaphoreCreateBinary();
+    _stopped = xSemaphoreCreateBinary();
+    if (xTaskCreate(_run, "mqtt_dispatch", stackSize, this, taskPriority, &_task) != pdPASS)
+        _task = nullptr;
+}
+
+PsychicMqttDispatcher::~PsychicMqttDispatcher()
+{
+    if (_task != nullptr)
+    {
+        _stopping = true;
+        xSemaphoreGive(_wakeup);
+        xSemaphoreTake(_stopped, portMAX_DELAY);
+    }
+    while (Message *message = _pop())
+        free(message);
+    vSemaphoreDelete(_lock);
+    vSemaphoreDelete(_wakeup);
+    vSemaphoreDelete(_stopped);
+}
+
+bool PsychicMqttDispatcher::push(PsychicMqttPriority_t priority, const char *topic, const char *payload, int length,
+                                 int qos, int retain, bool dup)
+{
+    int lane = (unsigned)priority < PSYCHIC_MQTT_PRIORITY_LANES ? priority : PSYCHIC_MQTT_PRIORITY_LOW;
+    size_t topicLength = strlen(topic);
+    size_t size = sizeof(Message) + topicLength + 1 + length + 1;
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    bool fits = _bytes[lane] + size <= _limit;
+    if (fits)
+        _bytes[lane] += size;
+    else
+        _stats.dropped++;
+    xSemaphoreGive(_lock);
+    if (!fits)
+        return false;
+
+    Message *message = (Message *)malloc(size);
+    if (message == nullptr)
+    {
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        _bytes[lane] -= size;
+        _stats.dropped++;
+        xSemaphoreGive(_lock);
+        return false;
+    }
+    message->next = nullptr;
+    message->size = size;
+    message->priority = lane;
+    message->qos = qos;
+    message->retain = retain;
+    message->dup = dup;
+    message->length = length;
+    message->queuedAt = esp_timer_get_time();
+    message->topic = (char *)(message + 1);
+    memcpy(message->topic, topic, topicLength + 1);
+    message->payload = message->topic + topicLength + 1;
+    memcpy(message->payload, payload, length);
+    message->payload[length] = '\0';
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    if (_tail[lane] != nullptr)
+        _tail[lane]->next = message;
+    else
+        _head[lane] = message;
+    _tail[lane] = message;
+    PsychicMqttLaneStats_t &stats = _stats.classes[lane];
+    stats.depth++;
+    stats.queued++;
+    if (stats.depth > stats.maxDepth)
+        stats.maxDepth = stats.depth;
+    xSemaphoreGive(_lock);
+
+    xSemaphoreGive(_wakeup);
+    return true;
+}
+
+PsychicMqttDispatcher::Message *PsychicMqttDispatcher::_pop()
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    Message *message = nullptr;
+    for (int lane = 0; lane < PSYCHIC_MQTT_PRIORITY_LANES && message == nullptr; lane++)
+    {
+        message = _head[lane];
+        if (message == nullptr)
+            continue;
+        _head[lane] = message->next;
+        if (_head[lane] == nullptr)
+            _tail[lane] = nullptr;
+        _bytes[lane] -= message->size;
+
+        PsychicMqttLaneStats_t &stats = _stats.classes[lane];
+        uint32_t wait = esp_timer_get_time() - message->queuedAt;
+        stats.depth--;
+        stats.avgWait = stats.avgWait == 0 ? wait : (int32_t)stats.avgWait + ((int32_t)wait - (int32_t)stats.avgWait) / 8;
+        if (wait > stats.maxWait)
+            stats.maxWait = wait;
+    }
+    xSemaphoreGive(_lock);
+    return message;
+}
+
+void PsychicMqttDispatcher::_run(void *arg)
+{
+    PsychicMqttDispatcher *dispatcher = (PsychicMqttDispatcher *)arg;
+    while (!dispatcher->_stopping)
+    {
+        xSemaphoreTake(dispatcher->_wakeup, portMAX_DELAY);
+        // The class is chosen again for every message, so a command overtakes a backlog
+        Message *message;
+        while (!dispatcher->_stopping && (message = dispatcher->_pop()) != nullptr)
+        {
+            dispatcher->_handler(message);
+            free(message);
+        }
+    }
+    xSemaphoreGive(dispatcher->_stopped);
+    vTaskDelete(nullptr);
+}
+
+PsychicMqttDispatchStats_t PsychicMqttDispatcher::stats()
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    PsychicMqttDispatchStats_t stats = _stats;
+    xSemaphoreGive(_lock);
+    return stats;
+}
+
+void PsychicMqttDispatcher::resetStats()
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    for (int lane = 0; lane < PSYCHIC_MQTT_PRIORITY_LANES; lane++)
+    {
+        uint32_t depth = _stats.classes[lane].depth;
+        _stats.classes[lane] = PsychicMqttLaneStats_t();
+        _stats.classes[lane].depth = depth;
+    }
+    _stats.dropped = 0;
+    xSemaphoreGive(_lock);
+}
@@ -0,0 +1,92 @@
+#pragma once
+/**
+ *   PsychicMqttClient
+ *
+ *   Off-task dispatch of received messages. The MQTT task copies each message
+ *   into a FIFO per priority class and goes back to the socket, a dispatch
+ *   task runs the handlers. The FIFOs are drained with strict priority: the
+ *   next message always comes from the highest class that has one, so a
+ *   command waits for at most the handler that is running, however many
+ *   telemetry messages are queued.
+ *
+ *   Each class is bounded by the bytes it holds. Messages beyond are dropped,
+ *   esp-mqtt has acknowledged them already.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "PsychicMqttLanes.h"
+
+typedef struct
+{
+    PsychicMqttLaneStats_t classes[PSYCHIC_MQTT_PRIORITY_LANES]; // indexed by PsychicMqttPriority_t
+    uint32_t dropped;                                            // messages beyond the limit of their class
+} PsychicMqttDispatchStats_t;
+
+class PsychicMqttDispatcher
+{
+public:
+    struct Message
+    {
+        Message *next;
+        size_t size; // allocation including topic and payload
+        int priority;
+        int qos;
+        int retain;
+        bool dup;
+        int length;
+        int64_t queuedAt;
+        char *topic;
+        char *payload; // null terminated
+    };
+
+    typedef std::function<void(Message *message)> Handler;
+
+    /**
+     * @param limit Maximum bytes of the messages in each class, including their headers.
+     * @param handler Runs in the dispatch task for every message.
+     * @param stackSize Stack of the dispatch task in bytes.
+     * @param taskPriority FreeRTOS priority of the dispatch task.
+     */
+    PsychicMqttDispatcher(size_t limit, Handler handler, uint32_t stackSize, UBaseType_t taskPriority);
+
+    /**
+     * @brief Stops the dispatch task after the running handler and frees the waiting messages.
+     * Must not be called from the dispatch task.
+     */
+    ~PsychicMqttDispatcher();
+
+    /**
+     * @brief Copies a message to the end of its class.
+     *
+     * @return False if the message does not fit into the limit of the class.
+     */
+    bool push(PsychicMqttPriority_t priority, const char *topic, const char *payload, int length, int qos,
+              int retain, bool dup);
+
+    bool running() { return _task != nullptr; }
+
+    PsychicMqttDispatchStats_t stats();
+    void resetStats();
+
+private:
+    SemaphoreHandle_t _lock;
+    SemaphoreHandle_t _wakeup;
+    SemaphoreHandle_t _stopped;
+    TaskHandle_t _task = nullptr;
+    volatile bool _stopping = false;
+    Handler _handler;
+    size_t _limit;
+    size_t _bytes[PSYCHIC_MQTT_PRIORITY_LANES] = {};
+    Message *_head[PSYCHIC_MQTT_PRIORITY_LANES] = {};
+    Message *_tail[PSYCHIC_MQTT_PRIORITY_LANES] = {};
+    PsychicMqttDispatchStats_t _stats = {};
+
+    Message *_pop();
+    static void _run(void *arg);
+};
@@ -0,0 +1,98 @@
+#include "PsychicMqttFramePool.h"
+
+#include <cstdlib>
+
+#define ALIGNMENT alignof(std::max_align_t)
+
+PsychicMqttFramePool::PsychicMqttFramePool(size_t blockSize, size_t blocks)
+{
+    if (blockSize < sizeof(Block))
+        blockSize = sizeof(Block);
+    _blockSize = (blockSize + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    _blocks = blocks;
+}
+
+PsychicMqttFramePool::~PsychicMqttFramePool()
+{
+    free(_memory);
+}
+
+void *PsychicMqttFramePool::allocate(size_t size)
+{
+    if (size <= _blockSize && _memory == nullptr && _blocks > 0)
+    {
+        // Allocated outside the critical section, a racing task may have been faster
+        char *memory = (char *)malloc(_blockSize * _blocks);
+        portENTER_CRITICAL(&_mux);
+        if (_memory == nullptr && memory != nullptr)
+        {
+            _memory = memory;
+            memory = nullptr;
+            for (size_t i = _blocks; i > 0; i--)
+            {
+                Block *block = (Block *)(_memory + (i - 1) * _blockSize);
+                block->next = _free;
+                _free = block;
+            }
+            _available = _blocks;
+        }
+        portEXIT_CRITICAL(&_mux);
+        free(memory);
+    }
+
+    Block *block = nullptr;
+    if (size <= _blockSize)
+    {
+        portENTER_CRITICAL(&_mux);
+        block = _free;
+        if (block != nullptr)
+        {
+            _free = block->next;
+            _available--;
+        }
+        portEXIT_CRITICAL(&_mux);
+    }
+
+    if (block != nullptr)
+    {
+        _allocated.fetch_add(1, std::memory_order_relaxed);
+        return block;
+    }
+    _fallbacks.fetch_add(1, std::memory_order_relaxed);
+    return malloc(size);
+}
+
+void PsychicMqttFramePool::release(void *memory)
+{
+    char *address = (char *)memory;
+    if (_memory == nullptr || address < _memory || address >= _memory + _blockSize * _blocks)
+    {
+        free(memory);
+        return;
+    }
+
+    Block *block = (Block *)memory;
+    portENTER_CRITICAL(&_mux);
+    block->next = _free;
+    _free = block;
+    _available++;
+    portEXIT_CRITICAL(&_mux);
+}
+
+PsychicMqttFramePoolStats_t PsychicMqttFramePool::stats()
+{
+    PsychicMqttFramePoolStats_t stats;
+    portENTER_CRITICAL(&_mux);
+    stats.available = _memory != nullptr ? _available : _blocks;
+    portEXIT_CRITICAL(&_mux);
+    stats.allocated = _allocated.load(std::memory_order_relaxed);
+    stats.fallbacks = _fallbacks.load(std::memory_order_relaxed);
+    return stats;
+}
+
+PsychicMqttFramePool &PsychicMqttFramePool::shared()
+{
+    // Never destroyed, frames may still be released by other tasks while statics are torn down
+    static PsychicMqttFramePool *pool = new PsychicMqttFramePool(PSYCHIC_MQTT_FRAME_SIZE, PSYCHIC_MQTT_FRAME_COUNT);
+    return *pool;
+}
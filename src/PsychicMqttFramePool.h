@@ -0,0 +1,77 @@
+#pragma once
+/**
+ *   PsychicMqttClient
+ *
+ *   Fixed-size block pool for coroutine frames. All blocks come from a single
+ *   allocation made on first use, free blocks are linked through their first
+ *   bytes. Allocating and releasing a block takes a few instructions in a
+ *   critical section, so awaiting an operation has no heap cost. Frames
+ *   larger than a block or beyond the pool fall back to the heap.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "freertos/FreeRTOS.h"
+
+#ifndef PSYCHIC_MQTT_FRAME_SIZE
+#define PSYCHIC_MQTT_FRAME_SIZE 384 // bytes per coroutine frame in the shared pool
+#endif
+#ifndef PSYCHIC_MQTT_FRAME_COUNT
+#define PSYCHIC_MQTT_FRAME_COUNT 16 // frames in the shared pool
+#endif
+
+typedef struct
+{
+    uint32_t available; // free blocks
+    uint32_t allocated; // frames taken from the pool
+    uint32_t fallbacks; // frames taken from the heap, too large or the pool was exhausted
+} PsychicMqttFramePoolStats_t;
+
+class PsychicMqttFramePool
+{
+public:
+    /**
+     * @param blockSize Bytes per block, rounded up to the alignment of any type.
+     * @param blocks Number of blocks.
+     */
+    PsychicMqttFramePool(size_t blockSize, size_t blocks);
+    ~PsychicMqttFramePool();
+
+    /**
+     * @brief Takes a block, or allocates from the heap if the size exceeds a block or no
+     * block is free.
+     *
+     * @return The memory, nullptr if the heap is exhausted too.
+     */
+    void *allocate(size_t size);
+
+    /**
+     * @brief Returns memory from allocate(), to the pool or to the heap.
+     */
+    void release(void *memory);
+
+    PsychicMqttFramePoolStats_t stats();
+
+    /**
+     * @brief The pool of PSYCHIC_MQTT_FRAME_COUNT blocks of PSYCHIC_MQTT_FRAME_SIZE bytes
+     * used by PsychicMqttTask.
+     */
+    static PsychicMqttFramePool &shared();
+
+private:
+    struct Block
+    {
+        Block *next;
+    };
+
+    size_t _blockSize;
+    size_t _blocks;
+    char *_memory = nullptr; // allocated on first use
+    Block *_free = nullptr;
+    uint32_t _available = 0;
+    std::atomic<uint32_t> _allocated{0};
+    std::atomic<uint32_t> _fallbacks{0};
+    portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+};
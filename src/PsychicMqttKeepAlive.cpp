@@ -0,0 +1,103 @@
+#include "PsychicMqttKeepAlive.h"
+
+PsychicMqttKeepAlive::PsychicMqttKeepAlive(uint16_t initial, uint16_t minKeepAlive, uint16_t maxKeepAlive)
+{
+    _lock = xSemaphoreCreateMutex();
+    _min = minKeepAlive > 0 ? minKeepAlive : 1;
+    _max = maxKeepAlive > _min ? maxKeepAlive : _min;
+    _stats.idleCap = _max;
+    _stats.keepAlive = initial < _min ? _min : (initial > _max ? _max : initial);
+}
+
+PsychicMqttKeepAlive::~PsychicMqttKeepAlive()
+{
+    vSemaphoreDelete(_lock);
+}
+
+uint16_t PsychicMqttKeepAlive::next()
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    uint32_t keepAlive = _stats.keepAlive;
+    if (_stats.pings > 0)
+    {
+        // Linear between the round trips of a fast and of a slow link
+        uint32_t rtt = _stats.srtt;
+        if (rtt <= PSYCHIC_MQTT_KEEPALIVE_FAST_RTT)
+            keepAlive = _min;
+        else if (rtt >= PSYCHIC_MQTT_KEEPALIVE_SLOW_RTT)
+            keepAlive = _max;
+        else
+            keepAlive = _min + (uint64_t)(_max - _min) * (rtt - PSYCHIC_MQTT_KEEPALIVE_FAST_RTT) /
+                                   (PSYCHIC_MQTT_KEEPALIVE_SLOW_RTT - PSYCHIC_MQTT_KEEPALIVE_FAST_RTT);
+    }
+    if (keepAlive > _stats.idleCap)
+        keepAlive = _stats.idleCap;
+    _stats.keepAlive = keepAlive;
+    xSemaphoreGive(_lock);
+    return keepAlive;
+}
+
+void PsychicMqttKeepAlive::connected(int64_t now)
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    _connectedAt = now;
+    xSemaphoreGive(_lock);
+}
+
+void PsychicMqttKeepAlive::sample(uint32_t rtt)
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    _stats.lastRtt = rtt;
+    if (_stats.pings == 0)
+    {
+        _stats.srtt = rtt;
+        _stats.minRtt = rtt;
+        _stats.maxRtt = rtt;
+    }
+    else
+    {
+        _stats.srtt = (int32_t)_stats.srtt + ((int32_t)rtt - (int32_t)_stats.srtt) / 8;
+        if (rtt < _stats.minRtt)
+            _stats.minRtt = rtt;
+        if (rtt > _stats.maxRtt)
+            _stats.maxRtt = rtt;
+    }
+    _stats.pings++;
+    xSemaphoreGive(_lock);
+}
+
+void PsychicMqttKeepAlive::disconnected(int64_t now, int64_t idle, bool timedOut)
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    if (_connectedAt == 0)
+    {
+        xSemaphoreGive(_lock);
+        return;
+    }
+    int64_t lived = now - _connectedAt;
+    int64_t keepAlive = (int64_t)_stats.keepAlive * 1000000;
+    _connectedAt = 0;
+
+    // Lasting two keepalives the link answered at least one ping, it was not broken from the start
+    if (timedOut && lived >= 2 * keepAlive && idle >= keepAlive)
+    {
+        // Pings every half keepalive were not enough to keep the path open
+        uint32_t cap = _stats.keepAlive * 3 / 4;
+        _stats.idleCap = cap > _min ? cap : _min;
+        _stats.idleDrops++;
+    }
+    else if (lived >= (int64_t)PSYCHIC_MQTT_KEEPALIVE_RELAX * 1000000 && _stats.idleCap < _max)
+    {
+        uint32_t cap = _stats.idleCap + _stats.idleCap / 4 + 1;
+        _stats.idleCap = cap < _max ? cap : _max;
+    }
+    xSemaphoreGive(_lock);
+}
+
+PsychicMqttKeepAliveStats_t PsychicMqttKeepAlive::stats()
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    PsychicMqttKeepAliveStats_t stats = _stats;
+    xSemaphoreGive(_lock);
+    return stats;
+}
@@ -0,0 +1,94 @@
+#pragma once
+/**
+ *   PsychicMqttClient
+ *
+ *   Adaptive keepalive. A short keepalive detects a dead link quickly, a long
+ *   one lets the radio sleep. The keepalive follows the measured round trip
+ *   between the bounds: links answering within PSYCHIC_MQTT_KEEPALIVE_FAST_RTT
+ *   get the minimum, links slower than PSYCHIC_MQTT_KEEPALIVE_SLOW_RTT, e.g.
+ *   cellular, the maximum.
+ *
+ *   A connection that survived a ping cycle, then went idle for longer than
+ *   its keepalive and ended by a keepalive timeout rather than a transport
+ *   error or a lost network suggests a NAT or firewall dropping idle
+ *   connections. The keepalive used is then capped at three quarters of its
+ *   value. The cap is relaxed again
+ *   after a connection stayed up for PSYCHIC_MQTT_KEEPALIVE_RELAX seconds.
+ *
+ *   esp-mqtt sends PINGREQ on its own and does not report PINGRESP, so the
+ *   round trip is measured by the client with QoS 1 probe publishes. It only
+ *   accepts a new keepalive before connecting, so next() is asked for the
+ *   keepalive of every connection.
+ */
+
+#include <cstdint>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#define PSYCHIC_MQTT_KEEPALIVE_FAST_RTT 50000  // us, round trips up to this get the minimum keepalive
+#define PSYCHIC_MQTT_KEEPALIVE_SLOW_RTT 500000 // us, round trips from this on get the maximum keepalive
+#define PSYCHIC_MQTT_KEEPALIVE_PROBES 3        // probe publishes after every connect
+#define PSYCHIC_MQTT_KEEPALIVE_RELAX 3600      // s a connection has to last to relax the idle cap
+
+typedef struct
+{
+    uint32_t keepAlive; // s, of the current or next connection
+    uint32_t idleCap;   // s, upper bound after idle drops
+    uint32_t pings;     // probe round trips measured
+    uint32_t lastRtt;   // us
+    uint32_t srtt;      // us, smoothed
+    uint32_t minRtt;    // us
+    uint32_t maxRtt;    // us
+    uint32_t idleDrops; // connections lost after being idle for longer than their keepalive
+} PsychicMqttKeepAliveStats_t;
+
+class PsychicMqttKeepAlive
+{
+public:
+    /**
+     * @param initial Keepalive in seconds until the first round trip was measured.
+     * @param minKeepAlive Lower bound in seconds.
+     * @param maxKeepAlive Upper bound in seconds.
+     */
+    PsychicMqttKeepAlive(uint16_t initial, uint16_t minKeepAlive, uint16_t maxKeepAlive);
+    ~PsychicMqttKeepAlive();
+
+    /**
+     * @brief Chooses the keepalive of the next connection.
+     *
+     * @return The keepalive in seconds.
+     */
+    uint16_t next();
+
+    /**
+     * @brief Starts a connection with the keepalive returned by next().
+     *
+     * @param now esp_timer_get_time() of the CONNACK.
+     */
+    void connected(int64_t now);
+
+    /**
+     * @brief Adds a measured round trip in microseconds.
+     */
+    void sample(uint32_t rtt);
+
+    /**
+     * @brief Ends a connection.
+     *
+     * @param now esp_timer_get_time() of the disconnect.
+     * @param idle Microseconds since the last packet received from the broker.
+     * @param timedOut True if the broker stopped answering pings, false if the application
+     * closed the connection, the transport failed or the network went down.
+     */
+    void disconnected(int64_t now, int64_t idle, bool timedOut);
+
+    PsychicMqttKeepAliveStats_t stats();
+
+private:
+    SemaphoreHandle_t _lock;
+    uint16_t _min;
+    uint16_t _max;
+    int64_t _connectedAt = 0;
+    PsychicMqttKeepAliveStats_t _stats = {};
+};
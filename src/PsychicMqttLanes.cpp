@@ -0,0 +1,120 @@
+#include "PsychicMqttLanes.h"
+
+#include "esp_timer.h"
+
+PsychicMqttLanes::PsychicMqttLanes(size_t limit)
+{
+    _lock = xSemaphoreCreateMutex();
+    for (int i = 0; i < PSYCHIC_MQTT_PRIORITY_LANES; i++)
+        _lanes[i] = new PsychicMqttQueue(limit);
+}
+
+PsychicMqttLanes::~PsychicMqttLanes()
+{
+    // Completes the waiting messages with a handler as dropped
+    for (int i = 0; i < PSYCHIC_MQTT_PRIORITY_LANES; i++)
+        delete _lanes[i];
+    vSemaphoreDelete(_lock);
+}
+
+bool PsychicMqttLanes::push(const char *topic, const char *payload, int length, int qos, bool retain,
+                            const OnPublishCompleteUserCallback *onComplete, uint32_t timeoutMs,
+                            PsychicMqttPriority_t priority)
+{
+    int lane = (unsigned)priority < PSYCHIC_MQTT_PRIORITY_LANES ? priority : PSYCHIC_MQTT_PRIORITY_LOW;
+    if (!_lanes[lane]->push(topic, payload, length, qos, retain, onComplete, timeoutMs, lane))
+        return false;
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    uint32_t depth = _lanes[lane]->count();
+    if (depth > _stats[lane].maxDepth)
+        _stats[lane].maxDepth = depth;
+    _stats[lane].queued++;
+    xSemaphoreGive(_lock);
+    return true;
+}
+
+int PsychicMqttLanes::_select()
+{
+    for (int round = 0; round < 2; round++)
+    {
+        for (int lane = 0; lane < PSYCHIC_MQTT_PRIORITY_LANES; lane++)
+        {
+            if (_credits[lane] > 0 && _lanes[lane]->count() > 0)
+                return lane;
+        }
+        // Every waiting lane used its turns
+        for (int lane = 0; lane < PSYCHIC_MQTT_PRIORITY_LANES; lane++)
+            _credits[lane] = _weights[lane];
+    }
+    return -1;
+}
+
+int PsychicMqttLanes::front(int &lane)
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    lane = _select();
+    int length = lane >= 0 ? _lanes[lane]->front() : -1;
+    xSemaphoreGive(_lock);
+    return length;
+}
+
+PsychicMqttQueue::Message *PsychicMqttLanes::pop(int lane)
+{
+    PsychicMqttQueue::Message *message = _lanes[lane]->pop();
+    if (message == nullptr)
+        return nullptr;
+
+    uint32_t wait = esp_timer_get_time() - message->queuedAt;
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    if (_credits[lane] > 0)
+        _credits[lane]--;
+    PsychicMqttLaneStats_t &stats = _stats[lane];
+    stats.avgWait = stats.avgWait == 0 ? wait : (int32_t)stats.avgWait + ((int32_t)wait - (int32_t)stats.avgWait) / 8;
+    if (wait > stats.maxWait)
+        stats.maxWait = wait;
+    xSemaphoreGive(_lock);
+    return message;
+}
+
+void PsychicMqttLanes::setWeights(uint32_t high, uint32_t normal, uint32_t low)
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    _weights[PSYCHIC_MQTT_PRIORITY_HIGH] = high > 0 ? high : 1;
+    _weights[PSYCHIC_MQTT_PRIORITY_NORMAL] = normal > 0 ? normal : 1;
+    _weights[PSYCHIC_MQTT_PRIORITY_LOW] = low > 0 ? low : 1;
+    xSemaphoreGive(_lock);
+}
+
+void PsychicMqttLanes::setLimit(size_t limit)
+{
+    for (int i = 0; i < PSYCHIC_MQTT_PRIORITY_LANES; i++)
+        _lanes[i]->setLimit(limit);
+}
+
+size_t PsychicMqttLanes::count()
+{
+    size_t count = 0;
+    for (int i = 0; i < PSYCHIC_MQTT_PRIORITY_LANES; i++)
+        count += _lanes[i]->count();
+    return count;
+}
+
+void PsychicMqttLanes::stats(PsychicMqttLaneStats_t *stats)
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    for (int i = 0; i < PSYCHIC_MQTT_PRIORITY_LANES; i++)
+    {
+        stats[i] = _stats[i];
+        stats[i].depth = _lanes[i]->count();
+    }
+    xSemaphoreGive(_lock);
+}
+
+void PsychicMqttLanes::resetStats()
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    for (int i = 0; i < PSYCHIC_MQTT_PRIORITY_LANES; i++)
+        _stats[i] = PsychicMqttLaneStats_t();
+    xSemaphoreGive(_lock);
+}
@@ -0,0 +1,104 @@
+#pragma once
+/**
+ *   PsychicMqttClient
+ *
+ *   Priority lanes in front of the outbox. Publishes beyond the in-flight
+ *   window wait in one FIFO per priority class instead of a single one, so
+ *   an alarm does not queue behind hundreds of telemetry points.
+ *
+ *   Lanes are served by weighted round robin: in every round each lane may
+ *   send up to its weight in messages, higher priorities first. Once every
+ *   waiting lane used its turns, a new round starts. With the default
+ *   weights a backlogged low lane still gets one in 13 slots of the window.
+ *
+ *   Any task may push, a single task at a time takes messages with front()
+ *   and pop().
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+#include "PsychicMqttQueue.h"
+
+typedef enum
+{
+    PSYCHIC_MQTT_PRIORITY_HIGH = 0, // commands, acknowledgements and alarms
+    PSYCHIC_MQTT_PRIORITY_NORMAL,   // default of publish()
+    PSYCHIC_MQTT_PRIORITY_LOW,      // bulk telemetry
+} PsychicMqttPriority_t;
+
+#define PSYCHIC_MQTT_PRIORITY_LANES 3
+
+#ifndef PSYCHIC_MQTT_PRIORITY_WEIGHTS
+#define PSYCHIC_MQTT_PRIORITY_WEIGHTS {8, 4, 1} // messages per round of the high, normal and low lane
+#endif
+
+typedef struct
+{
+    uint32_t depth;    // messages waiting
+    uint32_t maxDepth; // most messages waiting at once
+    uint32_t queued;   // messages that waited in the lane
+    uint32_t avgWait;  // us, smoothed time in the lane
+    uint32_t maxWait;  // us
+} PsychicMqttLaneStats_t;
+
+class PsychicMqttLanes
+{
+public:
+    /**
+     * @param limit Maximum bytes of the messages in each lane, including their headers.
+     */
+    explicit PsychicMqttLanes(size_t limit);
+    ~PsychicMqttLanes();
+
+    /**
+     * @brief Copies a message to the end of the lane of its priority.
+     *
+     * @return False if the message does not fit into the limit of the lane.
+     */
+    bool push(const char *topic, const char *payload, int length, int qos, bool retain,
+              const OnPublishCompleteUserCallback *onComplete, uint32_t timeoutMs, PsychicMqttPriority_t priority);
+
+    /**
+     * @brief Chooses the lane to send from next.
+     *
+     * @param lane Receives the lane to pass to pop().
+     * @return The payload length of the next message, or -1 if all lanes are empty.
+     */
+    int front(int &lane);
+
+    /**
+     * @brief Removes the first message of a lane chosen by front(), the caller frees it with
+     * PsychicMqttQueue::release().
+     */
+    PsychicMqttQueue::Message *pop(int lane);
+
+    /**
+     * @brief Changes the messages per round, a weight of 0 is taken as 1.
+     */
+    void setWeights(uint32_t high, uint32_t normal, uint32_t low);
+
+    /**
+     * @brief Changes the limit of every lane, messages already queued stay.
+     */
+    void setLimit(size_t limit);
+
+    size_t count();
+
+    /**
+     * @brief Copies the statistics of all lanes.
+     *
+     * @param stats Array of PSYCHIC_MQTT_PRIORITY_LANES entries, indexed by priority.
+     */
+    void stats(PsychicMqttLaneStats_t *stats);
+    void resetStats();
+
+private:
+    SemaphoreHandle_t _lock;
+    PsychicMqttQueue *_lanes[PSYCHIC_MQTT_PRIORITY_LANES];
+    uint32_t _weights[PSYCHIC_MQTT_PRIORITY_LANES] = PSYCHIC_MQTT_PRIORITY_WEIGHTS;
+    uint32_t _credits[PSYCHIC_MQTT_PRIORITY_LANES] = {};
+    PsychicMqttLaneStats_t _stats[PSYCHIC_MQTT_PRIORITY_LANES] = {};
+
+    int _select();
+};
@@ -0,0 +1,54 @@
+#pragma once
+/**
+ *   PsychicMqttClient
+ *
+ *   Compile time log level of the library, independent of CORE_DEBUG_LEVEL.
+ *   Set PSYCHIC_MQTT_LOG_LEVEL in the build flags to one of
+ *   0 = none, 1 = error, 2 = warning, 3 = info, 4 = debug, 5 = verbose.
+ *   Messages above this level are removed at compile time, so the formatting
+ *   cost is not paid even if the core logs verbosely. Defaults to info.
+ */
+
+#include "esp_log.h"
+
+#ifndef PSYCHIC_MQTT_LOG_LEVEL
+#define PSYCHIC_MQTT_LOG_LEVEL 3
+#endif
+
+// Disabled levels keep their arguments referenced so no unused variable warnings pop up
+#define PSYCHIC_LOG_DISABLED(tag, ...) \
+    do                                  \
+    {                                   \
+        if (0)                          \
+            ESP_LOGV(tag, __VA_ARGS__); \
+    } while (0)
+
+#if PSYCHIC_MQTT_LOG_LEVEL >= 1
+#define PSYCHIC_LOGE(tag, ...) ESP_LOGE(tag, __VA_ARGS__)
+#else
+#define PSYCHIC_LOGE(tag, ...) PSYCHIC_LOG_DISABLED(tag, __VA_ARGS__)
+#endif
+
+#if PSYCHIC_MQTT_LOG_LEVEL >= 2
+#define PSYCHIC_LOGW(tag, ...) ESP_LOGW(tag, __VA_ARGS__)
+#else
+#define PSYCHIC_LOGW(tag, ...) PSYCHIC_LOG_DISABLED(tag, __VA_ARGS__)
+#endif
+
+#if PSYCHIC_MQTT_LOG_LEVEL >= 3
+#define PSYCHIC_LOGI(tag, ...) ESP_LOGI(tag, __VA_ARGS__)
+#else
+#define PSYCHIC_LOGI(tag, ...) PSYCHIC_LOG_DISABLED(tag, __VA_ARGS__)
+#endif
+
+#if PSYCHIC_MQTT_LOG_LEVEL >= 4
+#define PSYCHIC_LOGD(tag, ...) ESP_LOGD(tag, __VA_ARGS__)
+#else
+#define PSYCHIC_LOGD(tag, ...) PSYCHIC_LOG_DISABLED(tag, __VA_ARGS__)
+#endif
+
+#if PSYCHIC_MQTT_LOG_LEVEL >= 5
+#define PSYCHIC_LOGV(tag, ...) ESP_LOGV(tag, __VA_ARGS__)
+#else
+#define PSYCHIC_LOGV(tag, ...) PSYCHIC_LOG_DISABLED(tag, __VA_ARGS__)
+#endif
@@ -0,0 +1,126 @@
+#include "PsychicMqttQueue.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "esp_timer.h"
+
+PsychicMqttQueue::PsychicMqttQueue(size_t limit) : _limit(limit)
+{
+    _lock = xSemaphoreCreateMutex();
+}
+
+PsychicMqttQueue::~PsychicMqttQueue()
+{
+    while (Message *message = pop())
+    {
+        if (message->onComplete)
+            message->onComplete(PSYCHIC_MQTT_PUBLISH_DROPPED, -1, 0);
+        release(message);
+    }
+    vSemaphoreDelete(_lock);
+}
+
+bool PsychicMqttQueue::push(const char *topic, const char *payload, int length, int qos, bool retain,
+                            const OnPublishCompleteUserCallback *onComplete, uint32_t timeoutMs, int priority)
+{
+    size_t topicLength = strlen(topic);
+    size_t size = sizeof(Message) + topicLength + 1 + length;
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    bool fits = _bytes + size <= _limit;
+    if (fits)
+        _bytes += size;
+    xSemaphoreGive(_lock);
+    if (!fits)
+        return false;
+
+    void *memory = malloc(size);
+    if (memory == nullptr)
+    {
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        _bytes -= size;
+        xSemaphoreGive(_lock);
+        return false;
+    }
+
+    Message *message = new (memory) Message();
+    message->size = size;
+    message->qos = qos;
+    message->retain = retain;
+    message->length = length;
+    message->timeoutMs = timeoutMs;
+    message->priority = priority;
+    message->queuedAt = esp_timer_get_time();
+    if (onComplete != nullptr)
+        message->onComplete = *onComplete;
+    message->topic = (char *)(message + 1);
+    memcpy(message->topic, topic, topicLength + 1);
+    message->payload = message->topic + topicLength + 1;
+    if (length > 0)
+        memcpy(message->payload, payload, length);
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    if (_tail != nullptr)
+        _tail->next = message;
+    else
+        _head = message;
+    _tail = message;
+    _count++;
+    xSemaphoreGive(_lock);
+    return true;
+}
+
+int PsychicMqttQueue::front()
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    int length = _head != nullptr ? _head->length : -1;
+    xSemaphoreGive(_lock);
+    return length;
+}
+
+PsychicMqttQueue::Message *PsychicMqttQueue::pop()
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    Message *message = _head;
+    if (message != nullptr)
+    {
+        _head = message->next;
+        if (_head == nullptr)
+            _tail = nullptr;
+        _bytes -= message->size;
+        _count--;
+    }
+    xSemaphoreGive(_lock);
+    return message;
+}
+
+void PsychicMqttQueue::release(Message *message)
+{
+    message->~Message();
+    free(message);
+}
+
+void PsychicMqttQueue::setLimit(size_t limit)
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    _limit = limit;
+    xSemaphoreGive(_lock);
+}
+
+size_t PsychicMqttQueue::count()
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    size_t count = _count;
+    xSemaphoreGive(_lock);
+    return count;
+}
+
+size_t PsychicMqttQueue::bytes()
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    size_t bytes = _bytes;
+    xSemaphoreGive(_lock);
+    return bytes;
+}
@@ -0,0 +1,88 @@
+#pragma once
+/**
+ *   PsychicMqttClient
+ *
+ *   FIFO of publishes waiting for room in the in-flight window or for the next
+ *   burst of the batch. Each message is a single allocation holding the
+ *   header, topic and payload, linked into a singly linked list. The queue is
+ *   bounded by the bytes it holds, so a stalled broker cannot exhaust the heap
+ *   through it either.
+ *
+ *   Any task may push, a single task at a time pops.
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "PsychicMqttCompletion.h"
+
+class PsychicMqttQueue
+{
+public:
+    struct Message
+    {
+        Message *next;
+        size_t size; // allocation including topic and payload
+        int qos;
+        bool retain;
+        int length;
+        uint32_t timeoutMs;
+        int priority;     // PsychicMqttPriority_t
+        int64_t queuedAt; // esp_timer_get_time() of push()
+        OnPublishCompleteUserCallback onComplete;
+        char *topic;
+        char *payload;
+    };
+
+    /**
+     * @param limit Maximum bytes of all queued messages, including their headers.
+     */
+    explicit PsychicMqttQueue(size_t limit);
+
+    /**
+     * @brief Completes all queued messages with a handler as dropped.
+     */
+    ~PsychicMqttQueue();
+
+    /**
+     * @brief Copies a message to the end of the queue.
+     *
+     * @param onComplete The completion handler, or nullptr.
+     * @param priority The priority class, kept with the message.
+     * @return False if the message does not fit into the limit.
+     */
+    bool push(const char *topic, const char *payload, int length, int qos, bool retain,
+              const OnPublishCompleteUserCallback *onComplete, uint32_t timeoutMs, int priority);
+
+    /**
+     * @brief Returns the payload length of the first message, or -1 if the queue is empty.
+     */
+    int front();
+
+    /**
+     * @brief Removes the first message, the caller frees it with release().
+     *
+     * @return The message, or nullptr if the queue is empty.
+     */
+    Message *pop();
+
+    static void release(Message *message);
+
+    /**
+     * @brief Changes the limit, messages already queued stay.
+     */
+    void setLimit(size_t limit);
+
+    size_t count();
+    size_t bytes();
+
+private:
+    SemaphoreHandle_t _lock;
+    size_t _limit;
+    size_t _bytes = 0;
+    size_t _count = 0;
+    Message *_head = nullptr;
+    Message *_tail = nullptr;
+};
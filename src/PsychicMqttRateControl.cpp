@@ -0,0 +1,205 @@
+#include "PsychicMqttRateControl.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include "esp_timer.h"
+
+#define TOKEN 1000000 // a token in millionths, rate * elapsed us gives the refill
+
+PsychicMqttRateControl::PsychicMqttRateControl(uint32_t maxRate, uint32_t minRate, size_t outboxLimit,
+                                               TopicMatcher match, OutboxSize outboxSize)
+    : _match(match), _outboxSize(outboxSize), _outboxLimit(outboxLimit)
+{
+    _lock = xSemaphoreCreateMutex();
+    _minRate = minRate > 0 ? minRate : 1;
+    _maxRate = maxRate > _minRate ? maxRate : _minRate;
+    _shared.refilledAt = esp_timer_get_time();
+    _setRate((int64_t)_maxRate * 1000);
+    _shared.tokens = _shared.capacity;
+}
+
+PsychicMqttRateControl::~PsychicMqttRateControl()
+{
+    for (auto &budget : _budgets)
+        free(budget.filter);
+    vSemaphoreDelete(_lock);
+}
+
+void PsychicMqttRateControl::setBudget(const char *filter, uint32_t rate, uint32_t burst)
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    for (auto it = _budgets.begin(); it != _budgets.end(); ++it)
+    {
+        if (strcmp(it->filter, filter) == 0)
+        {
+            free(it->filter);
+            _budgets.erase(it);
+            break;
+        }
+    }
+    if (rate > 0)
+    {
+        Budget budget;
+        budget.filter = strcpy((char *)malloc(strlen(filter) + 1), filter);
+        budget.bucket.rate = rate;
+        budget.bucket.capacity = (int64_t)(burst > 0 ? burst : rate) * TOKEN;
+        budget.bucket.tokens = budget.bucket.capacity;
+        budget.bucket.refilledAt = esp_timer_get_time();
+        _budgets.push_back(budget);
+    }
+    xSemaphoreGive(_lock);
+}
+
+bool PsychicMqttRateControl::admit(const char *topic)
+{
+    int64_t now = esp_timer_get_time();
+    _sampleOutbox(now);
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    _refill(_shared, now);
+    Bucket *budget = nullptr;
+    for (auto &entry : _budgets)
+    {
+        if (_match(topic, entry.filter))
+        {
+            budget = &entry.bucket;
+            _refill(*budget, now);
+            break;
+        }
+    }
+
+    bool admitted = _shared.tokens >= TOKEN && (budget == nullptr || budget->tokens >= TOKEN);
+    if (admitted)
+    {
+        _shared.tokens -= TOKEN;
+        if (budget != nullptr)
+            budget->tokens -= TOKEN;
+        _stats.admitted++;
+    }
+    else
+    {
+        _stats.rejected++;
+    }
+    xSemaphoreGive(_lock);
+    return admitted;
+}
+
+void PsychicMqttRateControl::sent(int msgId)
+{
+    int64_t now = esp_timer_get_time();
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    Sent &slot = _sent[(uint32_t)msgId % PSYCHIC_MQTT_RATE_SENT_SLOTS];
+    slot.msgId = msgId;
+    slot.sentAt = now;
+    xSemaphoreGive(_lock);
+}
+
+void PsychicMqttRateControl::acknowledged(int msgId)
+{
+    int64_t now = esp_timer_get_time();
+    _sampleOutbox(now);
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    Sent &slot = _sent[(uint32_t)msgId % PSYCHIC_MQTT_RATE_SENT_SLOTS];
+    if (slot.msgId != msgId || slot.sentAt == 0)
+    {
+        // Acknowledged before sent() was called or the slot was reused
+        xSemaphoreGive(_lock);
+        return;
+    }
+    uint32_t rtt = now - slot.sentAt;
+    slot.msgId = 0;
+    slot.sentAt = 0;
+
+    if (_stats.srtt == 0)
+        _stats.srtt = rtt;
+    else
+        _stats.srtt = (int32_t)_stats.srtt + ((int32_t)rtt - (int32_t)_stats.srtt) / 8;
+    // The minimum drifts up, so a permanently slower path becomes the new baseline
+    if (_stats.minRtt == 0 || rtt < _stats.minRtt)
+        _stats.minRtt = rtt;
+    else
+        _stats.minRtt += (rtt - _stats.minRtt) / 256;
+
+    _refill(_shared, now);
+    if (_congested())
+        _decrease(now);
+    else
+        _setRate(_rate + (int64_t)PSYCHIC_MQTT_RATE_INCREASE * 1000000 / _rate);
+    xSemaphoreGive(_lock);
+}
+
+PsychicMqttRateStats_t PsychicMqttRateControl::stats()
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    PsychicMqttRateStats_t stats = _stats;
+    xSemaphoreGive(_lock);
+    return stats;
+}
+
+void PsychicMqttRateControl::_refill(Bucket &bucket, int64_t now)
+{
+    bucket.tokens += (int64_t)bucket.rate * (now - bucket.refilledAt);
+    if (bucket.tokens > bucket.capacity)
+        bucket.tokens = bucket.capacity;
+    bucket.refilledAt = now;
+}
+
+void PsychicMqttRateControl::_setRate(int64_t rate)
+{
+    // Called with _lock held, after the shared bucket was refilled at the old rate
+    if (rate < (int64_t)_minRate * 1000)
+        rate = (int64_t)_minRate * 1000;
+    if (rate > (int64_t)_maxRate * 1000)
+        rate = (int64_t)_maxRate * 1000;
+    _rate = rate;
+    _shared.rate = rate / 1000;
+    _shared.capacity = (int64_t)_shared.rate * PSYCHIC_MQTT_RATE_BURST_MS * (TOKEN / 1000);
+    if (_shared.capacity < TOKEN)
+        _shared.capacity = TOKEN;
+    if (_shared.tokens > _shared.capacity)
+        _shared.tokens = _shared.capacity;
+    _stats.rate = _shared.rate;
+}
+
+void PsychicMqttRateControl::_sampleOutbox(int64_t now)
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    bool due = now - _outboxSampledAt >= PSYCHIC_MQTT_RATE_OUTBOX_SAMPLE * 1000;
+    if (due)
+        _outboxSampledAt = now;
+    xSemaphoreGive(_lock);
+    if (!due)
+        return;
+
+    // Queried without _lock, esp-mqtt dispatches events while holding its own lock
+    int outbox = _outboxSize();
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    _stats.outbox = outbox > 0 ? outbox : 0;
+    if (_stats.outbox > _outboxLimit)
+    {
+        _refill(_shared, now);
+        _decrease(now);
+    }
+    xSemaphoreGive(_lock);
+}
+
+bool PsychicMqttRateControl::_congested()
+{
+    bool slow = _stats.srtt > 2 * _stats.minRtt + PSYCHIC_MQTT_RATE_RTT_SLACK;
+    return slow || _stats.outbox > _outboxLimit;
+}
+
+void PsychicMqttRateControl::_decrease(int64_t now)
+{
+    // At most once per round trip, the acknowledgements in flight still reflect the old rate
+    int64_t holdOff = _stats.srtt > PSYCHIC_MQTT_RATE_OUTBOX_SAMPLE * 1000 ? _stats.srtt
+                                                                           : PSYCHIC_MQTT_RATE_OUTBOX_SAMPLE * 1000;
+    if (_decreasedAt != 0 && now - _decreasedAt < holdOff)
+        return;
+    _decreasedAt = now;
+    _setRate(_rate / 2);
+    _stats.decreases++;
+}
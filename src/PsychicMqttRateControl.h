@@ -0,0 +1,130 @@
+#pragma once
+/**
+ *   PsychicMqttClient
+ *
+ *   Congestion-aware admission control for asynchronous publishes. A token
+ *   bucket admits publishes at a rate that follows additive-increase /
+ *   multiplicative-decrease: every acknowledgement raises the rate slowly,
+ *   while a publish to acknowledgement time well above the observed minimum
+ *   or an outbox above its limit halves it, at most once per round trip.
+ *
+ *   Topic budgets are token buckets of their own, checked before the shared
+ *   one. A noisy topic exhausts its budget instead of the shared rate, which
+ *   keeps room for the other topics.
+ *
+ *   All methods are safe to call from any task.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#define PSYCHIC_MQTT_RATE_BURST_MS 250     // the shared bucket holds this much of the rate
+#define PSYCHIC_MQTT_RATE_INCREASE 2       // publishes per second added per second of acknowledgements
+#define PSYCHIC_MQTT_RATE_RTT_SLACK 20000  // us above twice the minimum round trip before backing off
+#define PSYCHIC_MQTT_RATE_SENT_SLOTS 64    // publishes tracked for the round trip time
+#define PSYCHIC_MQTT_RATE_OUTBOX_SAMPLE 100 // ms between outbox size samples
+
+typedef struct
+{
+    uint32_t rate;      // admitted publishes per second
+    uint32_t srtt;      // smoothed publish to acknowledgement time in us
+    uint32_t minRtt;    // lowest publish to acknowledgement time in us, slowly drifting up
+    uint32_t outbox;    // bytes in the outbox at the last sample
+    uint32_t admitted;  // publishes admitted
+    uint32_t rejected;  // publishes rejected by the shared rate or a topic budget
+    uint32_t decreases; // multiplicative decreases
+} PsychicMqttRateStats_t;
+
+class PsychicMqttRateControl
+{
+public:
+    typedef std::function<bool(const char *topic, const char *filter)> TopicMatcher;
+    typedef std::function<int()> OutboxSize;
+
+    /**
+     * @brief Creates a controller starting at the maximum rate.
+     *
+     * @param maxRate Upper bound of the admitted rate in publishes per second.
+     * @param minRate Lower bound of the admitted rate in publishes per second.
+     * @param outboxLimit Outbox size in bytes considered congested.
+     * @param match Matches a topic against the filter of a topic budget.
+     * @param outboxSize Returns the current outbox size in bytes.
+     */
+    PsychicMqttRateControl(uint32_t maxRate, uint32_t minRate, size_t outboxLimit, TopicMatcher match,
+                           OutboxSize outboxSize);
+    ~PsychicMqttRateControl();
+
+    /**
+     * @brief Limits the publishes to all topics matching a filter. The first matching
+     * budget applies, a budget for an existing filter is replaced.
+     *
+     * @param rate Publishes per second, 0 removes the budget.
+     * @param burst Publishes admitted at once after an idle period, 0 takes the rate.
+     */
+    void setBudget(const char *filter, uint32_t rate, uint32_t burst);
+
+    /**
+     * @brief Takes a token of the topic budget and the shared bucket.
+     *
+     * @return True if the publish is admitted.
+     */
+    bool admit(const char *topic);
+
+    /**
+     * @brief Starts the round trip measurement of an admitted QoS 1 or 2 publish.
+     */
+    void sent(int msgId);
+
+    /**
+     * @brief Ends the round trip measurement and adapts the rate.
+     */
+    void acknowledged(int msgId);
+
+    PsychicMqttRateStats_t stats();
+
+private:
+    struct Bucket
+    {
+        uint32_t rate;  // tokens per second
+        int64_t tokens; // in millionths of a token
+        int64_t capacity;
+        int64_t refilledAt;
+    };
+
+    struct Budget
+    {
+        char *filter;
+        Bucket bucket;
+    };
+
+    struct Sent
+    {
+        int msgId;
+        int64_t sentAt;
+    };
+
+    SemaphoreHandle_t _lock;
+    TopicMatcher _match;
+    OutboxSize _outboxSize;
+    uint32_t _maxRate;
+    uint32_t _minRate;
+    size_t _outboxLimit;
+    int64_t _rate; // in thousandths of a publish per second, for the additive increase
+    Bucket _shared = {};
+    std::vector<Budget> _budgets;
+    Sent _sent[PSYCHIC_MQTT_RATE_SENT_SLOTS] = {};
+    int64_t _decreasedAt = 0;
+    int64_t _outboxSampledAt = 0;
+    PsychicMqttRateStats_t _stats = {};
+
+    static void _refill(Bucket &bucket, int64_t now);
+    void _setRate(int64_t rate);
+    void _sampleOutbox(int64_t now);
+    bool _congested();
+    void _decrease(int64_t now);
+};
@@ -0,0 +1,192 @@
+#pragma once
+/**
+ *   PsychicMqttClient
+ *
+ *   Read-copy-update registry for the event handlers. The MQTT task iterates
+ *   the handlers of every event, while onTopic() and friends may be called from
+ *   any task at any time. Readers never take a lock: a ReadGuard pins the
+ *   current snapshot with a single atomic load. Writers copy the snapshot,
+ *   modify the copy and publish it atomically, serialized by a mutex.
+ *
+ *   A replaced snapshot is retired instead of freed, a reader may still iterate
+ *   it. Retired snapshots are freed after a grace period, i.e. once no reader
+ *   was inside a ReadGuard: by a write seeing no readers, or by the last reader
+ *   leaving. Writers never wait for readers, so a handler may register or
+ *   remove handlers from inside a callback.
+ *
+ *   Entries are held by std::shared_ptr, so per-handler state such as the
+ *   execution profile is shared by all snapshots and an entry is destroyed
+ *   together with the last snapshot referencing it.
+ */
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+template <typename T>
+class PsychicMqttRegistry
+{
+public:
+    typedef std::vector<std::shared_ptr<T>> Snapshot;
+
+    // Pins the snapshot that was current when the guard was created
+    class ReadGuard
+    {
+    public:
+        explicit ReadGuard(const PsychicMqttRegistry &registry) : _registry(&registry)
+        {
+            _registry->_readers.fetch_add(1);
+            _snapshot = registry._current.load();
+        }
+
+        ReadGuard(ReadGuard &&other) : _registry(other._registry), _snapshot(other._snapshot)
+        {
+            other._registry = nullptr;
+        }
+
+        ~ReadGuard()
+        {
+            if (_registry != nullptr)
+                _registry->_leave();
+        }
+
+        ReadGuard(const ReadGuard &) = delete;
+        ReadGuard &operator=(const ReadGuard &) = delete;
+
+        typename Snapshot::const_iterator begin() const { return _snapshot->begin(); }
+        typename Snapshot::const_iterator end() const { return _snapshot->end(); }
+        size_t size() const { return _snapshot->size(); }
+        bool empty() const { return _snapshot->empty(); }
+
+    private:
+        const PsychicMqttRegistry *_registry;
+        const Snapshot *_snapshot;
+    };
+
+    PsychicMqttRegistry() : _current(new Snapshot())
+    {
+        _writeLock = xSemaphoreCreateMutex();
+    }
+
+    ~PsychicMqttRegistry()
+    {
+        delete _current.load();
+        for (const auto &retired : _retired)
+            delete retired.snapshot;
+        vSemaphoreDelete(_writeLock);
+    }
+
+    PsychicMqttRegistry(const PsychicMqttRegistry &) = delete;
+    PsychicMqttRegistry &operator=(const PsychicMqttRegistry &) = delete;
+
+    /**
+     * @brief Pins the current snapshot for iteration. Lock-free, safe from any task.
+     */
+    ReadGuard read() const
+    {
+        return ReadGuard(*this);
+    }
+
+    /**
+     * @brief Appends an entry, visible to readers starting after the call.
+     */
+    void add(const std::shared_ptr<T> &entry)
+    {
+        xSemaphoreTake(_writeLock, portMAX_DELAY);
+        Snapshot *next = new Snapshot(*_current.load());
+        next->push_back(entry);
+        _publish(next);
+        xSemaphoreGive(_writeLock);
+    }
+
+    /**
+     * @brief Removes all entries matching the predicate.
+     *
+     * @return The number of removed entries.
+     */
+    template <typename Predicate>
+    size_t removeIf(Predicate predicate)
+    {
+        xSemaphoreTake(_writeLock, portMAX_DELAY);
+        const Snapshot *current = _current.load();
+        Snapshot *next = new Snapshot();
+        next->reserve(current->size());
+        for (const auto &entry : *current)
+        {
+            if (!predicate(*entry))
+                next->push_back(entry);
+        }
+        size_t removed = current->size() - next->size();
+        if (removed > 0)
+            _publish(next);
+        else
+            delete next;
+        xSemaphoreGive(_writeLock);
+        return removed;
+    }
+
+    /**
+     * @brief Removes all entries.
+     */
+    void clear()
+    {
+        xSemaphoreTake(_writeLock, portMAX_DELAY);
+        _publish(new Snapshot());
+        xSemaphoreGive(_writeLock);
+    }
+
+private:
+    struct Retired
+    {
+        Snapshot *snapshot;
+        uint32_t generation; // _generation after the snapshot was replaced
+    };
+
+    std::atomic<Snapshot *> _current;
+    mutable std::atomic<uint32_t> _readers{0};
+    std::atomic<uint32_t> _generation{0};  // counts the writes
+    mutable std::vector<Retired> _retired; // guarded by _writeLock
+    SemaphoreHandle_t _writeLock;
+
+    void _publish(Snapshot *next)
+    {
+        _retired.push_back({_current.exchange(next), _generation.fetch_add(1) + 1});
+
+        // A reader entering from here on loads the new snapshot. If none is inside a guard
+        // right now, no one can still hold a retired one.
+        if (_readers.load() == 0)
+            _reclaim(_generation.load());
+    }
+
+    // Frees the snapshots retired up to a generation, the caller holds _writeLock
+    void _reclaim(uint32_t generation) const
+    {
+        size_t kept = 0;
+        for (const auto &retired : _retired)
+        {
+            if ((int32_t)(generation - retired.generation) >= 0)
+                delete retired.snapshot;
+            else
+                _retired[kept++] = retired;
+        }
+        _retired.resize(kept);
+    }
+
+    // Writes from inside a handler always see a reader, so the last reader leaving frees
+    // what they retired. Every snapshot retired before the generation read here was
+    // replaced before the count dropped to 0, no reader entering later can hold it.
+    void _leave() const
+    {
+        uint32_t generation = _generation.load();
+        if (_readers.fetch_sub(1) != 1)
+            return;
+        // A writer holding the lock frees or leaves it to the next reader leaving
+        if (xSemaphoreTake(_writeLock, 0) != pdTRUE)
+            return;
+        _reclaim(generation);
+        xSemaphoreGive(_writeLock);
+    }
+};
@@ -0,0 +1,125 @@
+#include "PsychicMqttReplay.h"
+#include "PsychicMqttClient.h"
+
+#include <cstring>
+
+static const char RECORD_MAGIC[4] = {'P', 'M', 'Q', 'R'};
+
+PsychicMqttReplay::PsychicMqttReplay(PsychicMqttClient &client) : _client(client)
+{
+}
+
+size_t PsychicMqttReplay::writeHeader(Print &output)
+{
+    uint8_t header[PSYCHIC_MQTT_RECORD_FILE_HEADER_SIZE] = {0};
+    memcpy(header, RECORD_MAGIC, sizeof(RECORD_MAGIC));
+    header[4] = PSYCHIC_MQTT_RECORD_VERSION;
+    return output.write(header, sizeof(header));
+}
+
+size_t PsychicMqttReplay::writeEvent(Print &output, const esp_mqtt_event_t *event, uint32_t delta)
+{
+    PsychicMqttRecordHeader_t header;
+    header.delta = delta;
+    header.eventId = (int8_t)event->event_id;
+    header.flags = (event->retain ? PSYCHIC_MQTT_RECORD_RETAIN : 0) | (event->dup ? PSYCHIC_MQTT_RECORD_DUP : 0) |
+                   (event->session_present ? PSYCHIC_MQTT_RECORD_SESSION_PRESENT : 0) |
+                   ((event->qos & 0x03) << PSYCHIC_MQTT_RECORD_QOS_SHIFT);
+    header.topicLength = event->topic != nullptr ? (uint16_t)event->topic_len : 0;
+    header.msgId = event->msg_id;
+    header.dataLength = event->data != nullptr && event->data_len > 0 ? (uint32_t)event->data_len : 0;
+    header.totalDataLength = (uint32_t)event->total_data_len;
+    header.currentDataOffset = (uint32_t)event->current_data_offset;
+
+    size_t written = output.write((const uint8_t *)&header, sizeof(header));
+    if (header.topicLength > 0)
+        written += output.write((const uint8_t *)event->topic, header.topicLength);
+    if (header.dataLength > 0)
+        written += output.write((const uint8_t *)event->data, header.dataLength);
+
+    if (event->event_id == MQTT_EVENT_ERROR)
+    {
+        PsychicMqttRecordError_t error = {};
+        if (event->error_handle != nullptr)
+        {
+            error.errorType = event->error_handle->error_type;
+            error.connectReturnCode = event->error_handle->connect_return_code;
+            error.transportSockErrno = event->error_handle->esp_transport_sock_errno;
+            error.tlsLastEspErr = event->error_handle->esp_tls_last_esp_err;
+            error.tlsStackErr = event->error_handle->esp_tls_stack_err;
+        }
+        written += output.write((const uint8_t *)&error, sizeof(error));
+    }
+    return written;
+}
+
+int PsychicMqttReplay::replay(const uint8_t *recording, size_t length, bool realtime)
+{
+    if (length < PSYCHIC_MQTT_RECORD_FILE_HEADER_SIZE || memcmp(recording, RECORD_MAGIC, sizeof(RECORD_MAGIC)) != 0 ||
+        recording[4] != PSYCHIC_MQTT_RECORD_VERSION)
+        return -1;
+
+    size_t offset = PSYCHIC_MQTT_RECORD_FILE_HEADER_SIZE;
+    int events = 0;
+    int64_t due = esp_timer_get_time();
+    esp_mqtt_error_codes_t error;
+
+    while (offset < length)
+    {
+        PsychicMqttRecordHeader_t header;
+        if (length - offset < sizeof(header))
+            return -1;
+        memcpy(&header, recording + offset, sizeof(header));
+        offset += sizeof(header);
+
+        size_t payload = (size_t)header.topicLength + header.dataLength;
+        size_t errorSize = header.eventId == MQTT_EVENT_ERROR ? sizeof(PsychicMqttRecordError_t) : 0;
+        if (length - offset < payload + errorSize)
+            return -1;
+
+        esp_mqtt_event_t event = {};
+        event.event_id = (esp_mqtt_event_id_t)header.eventId;
+        event.client = _client._client;
+        event.topic = header.topicLength > 0 ? (char *)recording + offset : nullptr;
+        event.topic_len = header.topicLength;
+        event.data = header.dataLength > 0 ? (char *)recording + offset + header.topicLength : nullptr;
+        event.data_len = header.dataLength;
+        event.total_data_len = header.totalDataLength;
+        event.current_data_offset = header.currentDataOffset;
+        event.msg_id = header.msgId;
+        event.retain = header.flags & PSYCHIC_MQTT_RECORD_RETAIN;
+        event.dup = header.flags & PSYCHIC_MQTT_RECORD_DUP;
+        event.session_present = (header.flags & PSYCHIC_MQTT_RECORD_SESSION_PRESENT) ? 1 : 0;
+        event.qos = (header.flags >> PSYCHIC_MQTT_RECORD_QOS_SHIFT) & 0x03;
+        offset += payload;
+
+        memset(&error, 0, sizeof(error));
+        if (errorSize > 0)
+        {
+            PsychicMqttRecordError_t recorded;
+            memcpy(&recorded, recording + offset, sizeof(recorded));
+            error.error_type = (esp_mqtt_error_type_t)recorded.errorType;
+            error.connect_return_code = (esp_mqtt_connect_return_code_t)recorded.connectReturnCode;
+            error.esp_transport_sock_errno = recorded.transportSockErrno;
+            error.esp_tls_last_esp_err = recorded.tlsLastEspErr;
+            error.esp_tls_stack_err = recorded.tlsStackErr;
+            offset += errorSize;
+        }
+        event.error_handle = &error;
+
+        if (realtime)
+        {
+            due += header.delta;
+            int64_t wait = due - esp_timer_get_time();
+            if (wait >= 2000)
+                vTaskDelay(pdMS_TO_TICKS(wait / 1000 - 1));
+            while (esp_timer_get_time() < due)
+            {
+            }
+        }
+
+        _client._onMqttEvent("MQTT_EVENTS", event.event_id, &event);
+        events++;
+    }
+    return events;
+}
@@ -0,0 +1,95 @@
+#pragma once
+/**
+ *   PsychicMqttClient
+ *
+ *   Record and replay of the raw esp_mqtt_event_t stream. A recording captures
+ *   every event as the ESP-IDF MQTT client dispatched it, including multipart
+ *   chunks and their timing, and can be fed back into a PsychicMqttClient
+ *   instance without any network. This turns captured traffic into a repeatable
+ *   benchmark for the topic matcher, the reassembly and the dispatch code.
+ *
+ *   File format, all integers little endian:
+ *   "PMQR", uint8_t version, 3 bytes reserved, then per event a
+ *   PsychicMqttRecordHeader_t followed by the topic, the data and, for
+ *   MQTT_EVENT_ERROR only, a PsychicMqttRecordError_t.
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Print.h"
+#include "mqtt_client.h"
+
+#define PSYCHIC_MQTT_RECORD_VERSION 1
+#define PSYCHIC_MQTT_RECORD_FILE_HEADER_SIZE 8
+
+#define PSYCHIC_MQTT_RECORD_RETAIN 0x01
+#define PSYCHIC_MQTT_RECORD_DUP 0x02
+#define PSYCHIC_MQTT_RECORD_SESSION_PRESENT 0x04
+#define PSYCHIC_MQTT_RECORD_QOS_SHIFT 4
+
+typedef struct __attribute__((packed))
+{
+    uint32_t delta; // microseconds since the previous event
+    int8_t eventId;
+    uint8_t flags; // PSYCHIC_MQTT_RECORD_* bits, QoS in bits 4-5
+    uint16_t topicLength;
+    int32_t msgId;
+    uint32_t dataLength;
+    uint32_t totalDataLength;
+    uint32_t currentDataOffset;
+} PsychicMqttRecordHeader_t;
+
+typedef struct __attribute__((packed))
+{
+    int32_t errorType;
+    int32_t connectReturnCode;
+    int32_t transportSockErrno;
+    int32_t tlsLastEspErr;
+    int32_t tlsStackErr;
+} PsychicMqttRecordError_t;
+
+class PsychicMqttClient;
+
+class PsychicMqttReplay
+{
+public:
+    /**
+     * @brief Creates a replay driver for a client instance. The client should not be
+     * connected to a broker, replayed events change its connection state.
+     *
+     * @param client The client the recorded events are dispatched to.
+     */
+    explicit PsychicMqttReplay(PsychicMqttClient &client);
+
+    /**
+     * @brief Dispatches all events of a recording to the client, as if they came from
+     * the ESP-IDF MQTT client. Runs in the calling task.
+     *
+     * @param recording The recording, e.g. a file read into memory.
+     * @param length Length of the recording in bytes.
+     * @param realtime Keep the recorded time between events instead of replaying at full speed.
+     * @return The number of events replayed, or -1 if the recording is invalid or truncated.
+     */
+    int replay(const uint8_t *recording, size_t length, bool realtime = false);
+
+    /**
+     * @brief Writes the file header of a recording.
+     *
+     * @return The number of bytes written.
+     */
+    static size_t writeHeader(Print &output);
+
+    /**
+     * @brief Appends one event to a recording.
+     *
+     * @param output The Print instance the recording is written to.
+     * @param event The event as dispatched by the ESP-IDF MQTT client.
+     * @param delta Microseconds since the previous event.
+     * @return The number of bytes written.
+     */
+    static size_t writeEvent(Print &output, const esp_mqtt_event_t *event, uint32_t delta);
+
+private:
+    PsychicMqttClient &_client;
+};
@@ -0,0 +1,244 @@
+#include "PsychicMqttRetainedCache.h"
+#include "PsychicMqttTrace.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include "esp_timer.h"
+
+// Header, topic and payload share one allocation
+struct PsychicMqttRetainedEntry
+{
+    int64_t updatedAt;
+    uint32_t hash;
+    uint32_t length;
+    uint8_t qos;
+    const char *topic;
+    const char *payload;
+};
+
+// Approximate cost of an index slot of the unordered_multimap
+#define RETAINED_INDEX_OVERHEAD 16
+
+const char *PsychicMqttRetainedView::topic() const
+{
+    return _entry->topic;
+}
+
+const char *PsychicMqttRetainedView::payload() const
+{
+    return _entry->payload;
+}
+
+size_t PsychicMqttRetainedView::length() const
+{
+    return _entry->length;
+}
+
+int PsychicMqttRetainedView::qos() const
+{
+    return _entry->qos;
+}
+
+int64_t PsychicMqttRetainedView::updatedAt() const
+{
+    return _entry->updatedAt;
+}
+
+PsychicMqttRetainedCache::PsychicMqttRetainedCache(size_t budget)
+{
+    _lock = xSemaphoreCreateMutex();
+    _stats.budget = budget;
+}
+
+PsychicMqttRetainedCache::~PsychicMqttRetainedCache()
+{
+    clear();
+    vSemaphoreDelete(_lock);
+}
+
+void PsychicMqttRetainedCache::store(const char *topic, const char *payload, size_t length, int qos, bool onlyIfCached)
+{
+    size_t topicLength = strlen(topic);
+    uint32_t hash = PsychicMqttTrace::hash(topic, topicLength);
+
+    if (length == 0)
+    {
+        erase(topic);
+        return;
+    }
+
+    size_t allocation = sizeof(PsychicMqttRetainedEntry) + topicLength + 1 + length + 1;
+    size_t size = allocation + sizeof(Node) + RETAINED_INDEX_OVERHEAD;
+    if (size > _stats.budget)
+        return;
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    Node *node = _find(topic, hash);
+    if (node == nullptr && onlyIfCached)
+    {
+        xSemaphoreGive(_lock);
+        return;
+    }
+
+    // Allocated under the lock, so a concurrent store of the same topic cannot insert twice
+    char *memory = (char *)malloc(allocation);
+    if (memory == nullptr)
+    {
+        xSemaphoreGive(_lock);
+        return;
+    }
+    PsychicMqttRetainedEntry *entry = (PsychicMqttRetainedEntry *)memory;
+    char *topicCopy = memory + sizeof(PsychicMqttRetainedEntry);
+    char *payloadCopy = topicCopy + topicLength + 1;
+    memcpy(topicCopy, topic, topicLength + 1);
+    memcpy(payloadCopy, payload, length);
+    payloadCopy[length] = '\0';
+    entry->updatedAt = esp_timer_get_time();
+    entry->hash = hash;
+    entry->length = length;
+    entry->qos = qos;
+    entry->topic = topicCopy;
+    entry->payload = payloadCopy;
+    std::shared_ptr<const PsychicMqttRetainedEntry> shared(entry, [](const PsychicMqttRetainedEntry *e)
+                                                           { free((void *)e); });
+
+    if (node != nullptr)
+    {
+        _stats.bytes -= node->size;
+        _unlink(node);
+    }
+    else
+    {
+        node = new Node();
+        _index.insert(std::make_pair(hash, node));
+        _stats.entries++;
+    }
+    node->entry = shared;
+    node->size = size;
+    _stats.bytes += size;
+    _pushFront(node);
+
+    while (_stats.bytes > _stats.budget && _tail != nullptr && _tail != node)
+    {
+        _remove(_tail, _tail->entry->hash);
+        _stats.evictions++;
+    }
+    xSemaphoreGive(_lock);
+}
+
+bool PsychicMqttRetainedCache::get(const char *topic, PsychicMqttRetainedView &view)
+{
+    uint32_t hash = PsychicMqttTrace::hash(topic, strlen(topic));
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    Node *node = _find(topic, hash);
+    if (node == nullptr)
+    {
+        _stats.misses++;
+        xSemaphoreGive(_lock);
+        view._entry.reset();
+        return false;
+    }
+    _stats.hits++;
+    _unlink(node);
+    _pushFront(node);
+    view._entry = node->entry;
+    xSemaphoreGive(_lock);
+    return true;
+}
+
+std::vector<PsychicMqttRetainedView> PsychicMqttRetainedCache::entries()
+{
+    std::vector<PsychicMqttRetainedView> views;
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    views.reserve(_stats.entries);
+    for (Node *node = _head; node != nullptr; node = node->next)
+    {
+        PsychicMqttRetainedView view;
+        view._entry = node->entry;
+        views.push_back(view);
+    }
+    xSemaphoreGive(_lock);
+    return views;
+}
+
+void PsychicMqttRetainedCache::erase(const char *topic)
+{
+    uint32_t hash = PsychicMqttTrace::hash(topic, strlen(topic));
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    Node *node = _find(topic, hash);
+    if (node != nullptr)
+        _remove(node, hash);
+    xSemaphoreGive(_lock);
+}
+
+void PsychicMqttRetainedCache::clear()
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    while (_head != nullptr)
+        _remove(_head, _head->entry->hash);
+    xSemaphoreGive(_lock);
+}
+
+PsychicMqttRetainedStats_t PsychicMqttRetainedCache::stats()
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    PsychicMqttRetainedStats_t stats = _stats;
+    xSemaphoreGive(_lock);
+    return stats;
+}
+
+PsychicMqttRetainedCache::Node *PsychicMqttRetainedCache::_find(const char *topic, uint32_t hash)
+{
+    auto range = _index.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (strcmp(it->second->entry->topic, topic) == 0)
+            return it->second;
+    }
+    return nullptr;
+}
+
+void PsychicMqttRetainedCache::_unlink(Node *node)
+{
+    if (node->prev != nullptr)
+        node->prev->next = node->next;
+    else
+        _head = node->next;
+    if (node->next != nullptr)
+        node->next->prev = node->prev;
+    else
+        _tail = node->prev;
+    node->prev = nullptr;
+    node->next = nullptr;
+}
+
+void PsychicMqttRetainedCache::_pushFront(Node *node)
+{
+    node->prev = nullptr;
+    node->next = _head;
+    if (_head != nullptr)
+        _head->prev = node;
+    _head = node;
+    if (_tail == nullptr)
+        _tail = node;
+}
+
+void PsychicMqttRetainedCache::_remove(Node *node, uint32_t hash)
+{
+    auto range = _index.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (it->second == node)
+        {
+            _index.erase(it);
+            break;
+        }
+    }
+    _unlink(node);
+    _stats.bytes -= node->size;
+    _stats.entries--;
+    delete node;
+}
@@ -0,0 +1,104 @@
+#pragma once
+/**
+ *   PsychicMqttClient
+ *
+ *   Local cache of retained messages keyed by topic. Each topic holds its latest
+ *   message in a single allocation. Once the memory budget is exceeded, entries
+ *   are evicted in least recently used order. Lookups return views which keep
+ *   their entry alive, so a view stays valid after the entry was replaced or
+ *   evicted. All methods are safe to call from any task.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+typedef struct
+{
+    uint32_t entries;
+    uint32_t bytes;  // memory charged against the budget
+    uint32_t budget; // bytes
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+} PsychicMqttRetainedStats_t;
+
+struct PsychicMqttRetainedEntry;
+
+class PsychicMqttRetainedView
+{
+public:
+    const char *topic() const;
+    const char *payload() const; // null terminated, binary payloads may contain further zeros
+    size_t length() const;
+    int qos() const;
+    int64_t updatedAt() const; // esp_timer_get_time() when the message was received
+
+    explicit operator bool() const { return _entry != nullptr; }
+
+private:
+    friend class PsychicMqttRetainedCache;
+    std::shared_ptr<const PsychicMqttRetainedEntry> _entry;
+};
+
+class PsychicMqttRetainedCache
+{
+public:
+    /**
+     * @brief Creates an empty cache.
+     *
+     * @param budget Maximum memory of all entries in bytes, including bookkeeping.
+     */
+    explicit PsychicMqttRetainedCache(size_t budget);
+    ~PsychicMqttRetainedCache();
+
+    /**
+     * @brief Stores the latest message of a topic. An empty payload removes the topic,
+     * as it clears the retained message on the broker.
+     *
+     * @param onlyIfCached Only replace an existing entry, e.g. for an update without
+     * retain flag on an established subscription.
+     */
+    void store(const char *topic, const char *payload, size_t length, int qos, bool onlyIfCached = false);
+
+    /**
+     * @brief Looks up a topic and marks it as recently used.
+     *
+     * @return True if the topic is cached.
+     */
+    bool get(const char *topic, PsychicMqttRetainedView &view);
+
+    /**
+     * @brief Returns views of all entries from most to least recently used.
+     */
+    std::vector<PsychicMqttRetainedView> entries();
+
+    void erase(const char *topic);
+    void clear();
+    PsychicMqttRetainedStats_t stats();
+
+private:
+    struct Node
+    {
+        std::shared_ptr<const PsychicMqttRetainedEntry> entry;
+        Node *prev;
+        Node *next;
+        size_t size;
+    };
+
+    SemaphoreHandle_t _lock;
+    std::unordered_multimap<uint32_t, Node *> _index; // topic hash
+    Node *_head = nullptr;                             // most recently used
+    Node *_tail = nullptr;
+    PsychicMqttRetainedStats_t _stats = {};
+
+    Node *_find(const char *topic, uint32_t hash);
+    void _unlink(Node *node);
+    void _pushFront(Node *node);
+    void _remove(Node *node, uint32_t hash);
+};
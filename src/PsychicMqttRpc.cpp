@@ -0,0 +1,175 @@
+#include "PsychicMqttRpc.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+PsychicMqttRpc::PsychicMqttRpc(const char *responseTopic, size_t maxInFlight)
+{
+    _responseTopicLength = strlen(responseTopic);
+    _responseTopic = strcpy((char *)malloc(_responseTopicLength + 1), responseTopic);
+    _responseFilter = (char *)malloc(_responseTopicLength + 3);
+    sprintf(_responseFilter, "%s/+", responseTopic);
+
+    _slotCount = maxInFlight == 0 ? 1 : (maxInFlight > 65536 ? 65536 : maxInFlight);
+    _slots = new Slot[_slotCount]();
+    _lock = xSemaphoreCreateMutex();
+
+    esp_timer_create_args_t timerArgs = {};
+    timerArgs.callback = _onTimeoutStatic;
+    timerArgs.arg = this;
+    timerArgs.name = "mqtt_rpc";
+    esp_timer_create(&timerArgs, &_timer);
+}
+
+PsychicMqttRpc::~PsychicMqttRpc()
+{
+    if (_timer != nullptr)
+    {
+        esp_timer_stop(_timer);
+        esp_timer_delete(_timer);
+    }
+
+    for (size_t i = 0; i < _slotCount; i++)
+    {
+        if (_slots[i].pending)
+        {
+            _slots[i].pending = false;
+            _slots[i].callback(PSYCHIC_MQTT_RPC_CANCELLED, nullptr, 0);
+        }
+    }
+
+    vSemaphoreDelete(_lock);
+    delete[] _slots;
+    free(_responseTopic);
+    free(_responseFilter);
+}
+
+uint32_t PsychicMqttRpc::begin(const OnRpcResponseUserCallback &callback, uint32_t timeoutMs, char *replyTopic,
+                               size_t replyTopicSize)
+{
+    if (replyTopicSize < replyTopicLength() + 1)
+        return 0;
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    if (_inFlight == _slotCount)
+    {
+        xSemaphoreGive(_lock);
+        return 0;
+    }
+
+    // Round robin, so a slot is reused as late as possible
+    while (_slots[_nextSlot].pending)
+        _nextSlot = (_nextSlot + 1) % _slotCount;
+    size_t index = _nextSlot;
+    _nextSlot = (_nextSlot + 1) % _slotCount;
+
+    Slot &slot = _slots[index];
+    slot.generation = slot.generation == UINT16_MAX ? 1 : slot.generation + 1;
+    slot.pending = true;
+    slot.deadline = esp_timer_get_time() + (int64_t)timeoutMs * 1000;
+    slot.callback = callback;
+    _inFlight++;
+    _arm();
+    xSemaphoreGive(_lock);
+
+    uint32_t id = ((uint32_t)slot.generation << 16) | index;
+    snprintf(replyTopic, replyTopicSize, "%s/%08x", _responseTopic, (unsigned)id);
+    return id;
+}
+
+bool PsychicMqttRpc::complete(uint32_t id, PsychicMqttRpcStatus_t status, const char *payload, int length)
+{
+    OnRpcResponseUserCallback callback;
+    if (!_take(id, callback))
+        return false;
+    callback(status, payload, length);
+    return true;
+}
+
+bool PsychicMqttRpc::reply(const char *topic, const char *payload, int length)
+{
+    if (strncmp(topic, _responseTopic, _responseTopicLength) != 0 || topic[_responseTopicLength] != '/')
+        return false;
+    const char *hex = topic + _responseTopicLength + 1;
+    if (strchr(hex, '/') != nullptr)
+        return false;
+
+    char *end;
+    uint32_t id = strtoul(hex, &end, 16);
+    if (strlen(hex) == PSYCHIC_MQTT_RPC_ID_LENGTH && *end == '\0')
+        complete(id, PSYCHIC_MQTT_RPC_OK, payload, length);
+    return true;
+}
+
+size_t PsychicMqttRpc::inFlight()
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    size_t inFlight = _inFlight;
+    xSemaphoreGive(_lock);
+    return inFlight;
+}
+
+bool PsychicMqttRpc::_take(uint32_t id, OnRpcResponseUserCallback &callback)
+{
+    size_t index = id & 0xffff;
+    uint16_t generation = id >> 16;
+    if (index >= _slotCount)
+        return false;
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    Slot &slot = _slots[index];
+    // A late reply to a slot that timed out and was reused carries an older generation
+    bool pending = slot.pending && slot.generation == generation;
+    if (pending)
+    {
+        slot.pending = false;
+        callback = std::move(slot.callback);
+        slot.callback = nullptr;
+        _inFlight--;
+    }
+    xSemaphoreGive(_lock);
+    return pending;
+}
+
+void PsychicMqttRpc::_arm()
+{
+    // Called with _lock held. A single one-shot timer tracks the earliest deadline.
+    int64_t earliest = INT64_MAX;
+    for (size_t i = 0; i < _slotCount && _inFlight > 0; i++)
+    {
+        if (_slots[i].pending && _slots[i].deadline < earliest)
+            earliest = _slots[i].deadline;
+    }
+    esp_timer_stop(_timer);
+    if (earliest != INT64_MAX)
+    {
+        int64_t delay = earliest - esp_timer_get_time();
+        esp_timer_start_once(_timer, delay > 0 ? delay : 0);
+    }
+}
+
+void PsychicMqttRpc::_onTimeoutStatic(void *arg)
+{
+    ((PsychicMqttRpc *)arg)->_onTimeout();
+}
+
+void PsychicMqttRpc::_onTimeout()
+{
+    int64_t now = esp_timer_get_time();
+    for (size_t i = 0; i < _slotCount; i++)
+    {
+        uint32_t id = 0;
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        if (_slots[i].pending && _slots[i].deadline <= now)
+            id = ((uint32_t)_slots[i].generation << 16) | i;
+        xSemaphoreGive(_lock);
+        if (id != 0)
+            complete(id, PSYCHIC_MQTT_RPC_TIMEOUT);
+    }
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    _arm();
+    xSemaphoreGive(_lock);
+}
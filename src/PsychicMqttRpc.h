@@ -0,0 +1,110 @@
+#pragma once
+/**
+ *   PsychicMqttClient
+ *
+ *   Pending-request table of the request/response layer. Every call occupies a
+ *   slot until its reply arrived or its timeout expired. The correlation ID
+ *   encodes the slot index and a generation counter, so a reply is matched in
+ *   O(1) and a late reply to a reused slot is recognized and dropped.
+ *
+ *   Wire format, compatible with any MQTT 3.1.1 peer:
+ *   - The request payload starts with the response topic and a newline,
+ *     followed by the request body.
+ *   - The response topic is <response base>/<correlation ID as 8 hex digits>.
+ *     All responses arrive on the single subscription <response base>/+.
+ *
+ *   Each call completes exactly once: with the reply, on timeout from the
+ *   esp_timer task, or as cancelled when the table is destroyed.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#define PSYCHIC_MQTT_RPC_ID_LENGTH 8 // hex digits of the correlation ID
+
+typedef enum
+{
+    PSYCHIC_MQTT_RPC_OK = 0,    // the reply arrived
+    PSYCHIC_MQTT_RPC_TIMEOUT,   // no reply within the timeout
+    PSYCHIC_MQTT_RPC_FAILED,    // the request could not be published or all slots are in use
+    PSYCHIC_MQTT_RPC_CANCELLED, // the client was destroyed or the RPC layer reconfigured
+} PsychicMqttRpcStatus_t;
+
+typedef std::function<void(PsychicMqttRpcStatus_t status, const char *payload, int length)> OnRpcResponseUserCallback;
+
+class PsychicMqttRpc
+{
+public:
+    /**
+     * @brief Creates an empty pending-request table.
+     *
+     * @param responseTopic Base of the response topics, without trailing slash.
+     * @param maxInFlight Maximum number of pending calls, at most 65536.
+     */
+    PsychicMqttRpc(const char *responseTopic, size_t maxInFlight);
+
+    /**
+     * @brief Completes all pending calls as cancelled.
+     */
+    ~PsychicMqttRpc();
+
+    /**
+     * @brief Reserves a slot for a new call and arms its timeout.
+     *
+     * @param callback Completion of the call.
+     * @param timeoutMs Timeout in milliseconds.
+     * @param replyTopic Receives the response topic of the call.
+     * @param replyTopicSize Size of replyTopic, at least replyTopicLength() + 1.
+     * @return The correlation ID, 0 if all slots are in use.
+     */
+    uint32_t begin(const OnRpcResponseUserCallback &callback, uint32_t timeoutMs, char *replyTopic, size_t replyTopicSize);
+
+    /**
+     * @brief Completes a pending call, e.g. as failed when it could not be published.
+     *
+     * @return True if the call was still pending.
+     */
+    bool complete(uint32_t id, PsychicMqttRpcStatus_t status, const char *payload = nullptr, int length = 0);
+
+    /**
+     * @brief Routes a message received on the response subscription to its call. Responses
+     * to calls that already timed out are dropped.
+     *
+     * @return True if the topic is a response topic, i.e. the message is consumed.
+     */
+    bool reply(const char *topic, const char *payload, int length);
+
+    size_t inFlight();
+    const char *responseTopic() const { return _responseTopic; }
+    const char *responseFilter() const { return _responseFilter; }
+    size_t replyTopicLength() const { return _responseTopicLength + 1 + PSYCHIC_MQTT_RPC_ID_LENGTH; }
+
+private:
+    struct Slot
+    {
+        uint16_t generation;
+        bool pending;
+        int64_t deadline;
+        OnRpcResponseUserCallback callback;
+    };
+
+    char *_responseTopic;
+    char *_responseFilter; // <response base>/+
+    size_t _responseTopicLength;
+    Slot *_slots;
+    size_t _slotCount;
+    size_t _nextSlot = 0;
+    size_t _inFlight = 0;
+    SemaphoreHandle_t _lock;
+    esp_timer_handle_t _timer = nullptr;
+
+    bool _take(uint32_t id, OnRpcResponseUserCallback &callback);
+    void _arm();
+    static void _onTimeoutStatic(void *arg);
+    void _onTimeout();
+};
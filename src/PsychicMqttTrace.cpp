@@ -0,0 +1,140 @@
+#include "PsychicMqttTrace.h"
+
+#include <cstdlib>
+#include "esp_timer.h"
+
+PsychicMqttTrace::PsychicMqttTrace(size_t records)
+{
+    size_t capacity = 1;
+    while (capacity < records)
+        capacity <<= 1;
+
+    _slots = new Slot[capacity];
+    _mask = capacity - 1;
+    clear();
+}
+
+PsychicMqttTrace::~PsychicMqttTrace()
+{
+    delete[] _slots;
+}
+
+void PsychicMqttTrace::record(PsychicMqttTraceEvent_t event, int msgId, uint32_t topicHash, uint32_t length, int qos)
+{
+    uint32_t index = _head.fetch_add(1, std::memory_order_relaxed);
+    Slot &slot = _slots[index & _mask];
+
+    // Mark the slot as being written, so a concurrent reader skips it
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.record.timestamp = (uint32_t)esp_timer_get_time();
+    slot.record.topicHash = topicHash;
+    slot.record.length = length;
+    slot.record.msgId = (uint16_t)msgId;
+    slot.record.event = (uint8_t)event;
+    slot.record.qos = (uint8_t)qos;
+
+    slot.sequence.store(index + 1, std::memory_order_release);
+}
+
+size_t PsychicMqttTrace::read(PsychicMqttTraceRecord_t *records, size_t maxRecords)
+{
+    uint32_t head = _head.load(std::memory_order_acquire);
+    uint32_t available = head < capacity() ? head : capacity();
+    if (available > maxRecords)
+        available = maxRecords;
+
+    size_t copied = 0;
+    for (uint32_t index = head - available; index != head; index++)
+    {
+        Slot &slot = _slots[index & _mask];
+        uint32_t before = slot.sequence.load(std::memory_order_acquire);
+        if (before != index + 1)
+            continue; // overwritten or still being written
+
+        records[copied] = slot.record;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) == before)
+            copied++;
+    }
+    return copied;
+}
+
+void PsychicMqttTrace::dump(Print &output)
+{
+    PsychicMqttTraceRecord_t record;
+    uint32_t head = _head.load(std::memory_order_acquire);
+    uint32_t available = head < capacity() ? head : capacity();
+
+    output.printf("MQTT trace, %u records\r\n", (unsigned)available);
+    for (uint32_t index = head - available; index != head; index++)
+    {
+        Slot &slot = _slots[index & _mask];
+        uint32_t before = slot.sequence.load(std::memory_order_acquire);
+        if (before != index + 1)
+            continue;
+        record = slot.record;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != before)
+            continue;
+
+        output.printf("%10u us %-16s msg_id=%-5u topic=%08x len=%u qos=%u\r\n", (unsigned)record.timestamp,
+                      eventName(record.event), (unsigned)record.msgId, (unsigned)record.topicHash,
+                      (unsigned)record.length, (unsigned)record.qos);
+    }
+}
+
+void PsychicMqttTrace::clear()
+{
+    for (uint32_t i = 0; i <= _mask; i++)
+        _slots[i].sequence.store(0, std::memory_order_relaxed);
+    _head.store(0, std::memory_order_release);
+}
+
+uint32_t PsychicMqttTrace::hash(const char *data, size_t length)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (uint8_t)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+const char *PsychicMqttTrace::eventName(uint8_t event)
+{
+    switch (event)
+    {
+    case PSYCHIC_MQTT_TRACE_BEFORE_CONNECT:
+        return "BEFORE_CONNECT";
+    case PSYCHIC_MQTT_TRACE_CONNECTED:
+        return "CONNECTED";
+    case PSYCHIC_MQTT_TRACE_DISCONNECTED:
+        return "DISCONNECTED";
+    case PSYCHIC_MQTT_TRACE_SUBSCRIBE:
+        return "SUBSCRIBE";
+    case PSYCHIC_MQTT_TRACE_SUBSCRIBED:
+        return "SUBSCRIBED";
+    case PSYCHIC_MQTT_TRACE_UNSUBSCRIBE:
+        return "UNSUBSCRIBE";
+    case PSYCHIC_MQTT_TRACE_UNSUBSCRIBED:
+        return "UNSUBSCRIBED";
+    case PSYCHIC_MQTT_TRACE_PUBLISH:
+        return "PUBLISH";
+    case PSYCHIC_MQTT_TRACE_PUBLISHED:
+        return "PUBLISHED";
+    case PSYCHIC_MQTT_TRACE_PUBLISH_DROPPED:
+        return "PUBLISH_DROPPED";
+    case PSYCHIC_MQTT_TRACE_DATA:
+        return "DATA";
+    case PSYCHIC_MQTT_TRACE_DATA_CHUNK:
+        return "DATA_CHUNK";
+    case PSYCHIC_MQTT_TRACE_ERROR:
+        return "ERROR";
+    default:
+        return "OTHER";
+    }
+}
@@ -0,0 +1,94 @@
+#pragma once
+/**
+ *   PsychicMqttClient
+ *
+ *   Fixed size binary trace ring for the hot paths of the MQTT client. Records
+ *   are written lock-free from any task without printf formatting and can be
+ *   read out or dumped as text on demand.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "Print.h"
+
+typedef enum
+{
+    PSYCHIC_MQTT_TRACE_BEFORE_CONNECT = 0,
+    PSYCHIC_MQTT_TRACE_CONNECTED,
+    PSYCHIC_MQTT_TRACE_DISCONNECTED,
+    PSYCHIC_MQTT_TRACE_SUBSCRIBE,
+    PSYCHIC_MQTT_TRACE_SUBSCRIBED,
+    PSYCHIC_MQTT_TRACE_UNSUBSCRIBE,
+    PSYCHIC_MQTT_TRACE_UNSUBSCRIBED,
+    PSYCHIC_MQTT_TRACE_PUBLISH,
+    PSYCHIC_MQTT_TRACE_PUBLISHED,
+    PSYCHIC_MQTT_TRACE_PUBLISH_DROPPED,
+    PSYCHIC_MQTT_TRACE_DATA,
+    PSYCHIC_MQTT_TRACE_DATA_CHUNK,
+    PSYCHIC_MQTT_TRACE_ERROR,
+    PSYCHIC_MQTT_TRACE_OTHER,
+} PsychicMqttTraceEvent_t;
+
+typedef struct
+{
+    uint32_t timestamp; // esp_timer_get_time() in microseconds, wraps after ~71 minutes
+    uint32_t topicHash; // FNV-1a hash of the topic, 0 if the event has no topic
+    uint32_t length;    // payload length
+    uint16_t msgId;
+    uint8_t event; // PsychicMqttTraceEvent_t
+    uint8_t qos;
+} PsychicMqttTraceRecord_t;
+
+class PsychicMqttTrace
+{
+public:
+    /**
+     * @brief Creates a trace ring.
+     *
+     * @param records Capacity of the ring, rounded up to the next power of two.
+     */
+    explicit PsychicMqttTrace(size_t records);
+    ~PsychicMqttTrace();
+
+    /**
+     * @brief Appends a record. Safe to call from any task, overwrites the oldest record.
+     */
+    void record(PsychicMqttTraceEvent_t event, int msgId = 0, uint32_t topicHash = 0, uint32_t length = 0, int qos = 0);
+
+    /**
+     * @brief Copies the records from oldest to newest.
+     *
+     * @param records Destination array.
+     * @param maxRecords Size of the destination array.
+     * @return The number of records copied.
+     */
+    size_t read(PsychicMqttTraceRecord_t *records, size_t maxRecords);
+
+    /**
+     * @brief Prints all records from oldest to newest as text.
+     */
+    void dump(Print &output);
+
+    /**
+     * @brief Discards all records.
+     */
+    void clear();
+
+    size_t capacity() const { return _mask + 1; }
+
+    static uint32_t hash(const char *data, size_t length);
+    static const char *eventName(uint8_t event);
+
+private:
+    struct Slot
+    {
+        std::atomic<uint32_t> sequence; // index + 1 of the record in this slot, 0 while written
+        PsychicMqttTraceRecord_t record;
+    };
+
+    Slot *_slots = nullptr;
+    uint32_t _mask = 0;
+    std::atomic<uint32_t> _head{0};
+};
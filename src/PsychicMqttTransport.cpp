@@ -0,0 +1,285 @@
+#include "PsychicMqttTransport.h"
+
+#include <errno.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+#include "esp_timer.h"
+#include "freertos/task.h"
+
+/*------------------------------------------------------------------------------------------------*/
+// In-memory loopback
+/*------------------------------------------------------------------------------------------------*/
+
+PsychicMqttLoopback::PsychicMqttLoopback(size_t bufferSize)
+{
+    _toClient = xStreamBufferCreate(bufferSize, 1);
+    _toPeer = xStreamBufferCreate(bufferSize, 1);
+}
+
+PsychicMqttLoopback::~PsychicMqttLoopback()
+{
+    // Still set if the handle was never passed to a client
+    if (_transport != nullptr)
+        esp_transport_destroy(_transport);
+    vStreamBufferDelete(_toClient);
+    vStreamBufferDelete(_toPeer);
+}
+
+esp_transport_handle_t PsychicMqttLoopback::transport()
+{
+    if (_transport == nullptr)
+    {
+        _transport = esp_transport_init();
+        esp_transport_set_func(_transport, _connect, _read, _write, _close, _pollRead, _pollWrite, _destroy);
+        esp_transport_set_context_data(_transport, this);
+    }
+    return _transport;
+}
+
+bool PsychicMqttLoopback::accept(int timeoutMs)
+{
+    int64_t deadline = esp_timer_get_time() + (int64_t)timeoutMs * 1000;
+    while (_sessions.load() == _accepted)
+    {
+        if (esp_timer_get_time() >= deadline)
+            return false;
+        vTaskDelay(1);
+    }
+    _accepted = _sessions.load();
+    return true;
+}
+
+int PsychicMqttLoopback::read(uint8_t *buffer, size_t length, int timeoutMs)
+{
+    // A new connection replaces the one the peer is serving
+    if (_sessions.load() != _accepted)
+        return -1;
+    return _receive(_toPeer, buffer, length, timeoutMs);
+}
+
+int PsychicMqttLoopback::write(const uint8_t *data, size_t length, int timeoutMs)
+{
+    if (_sessions.load() != _accepted)
+        return -1;
+    return _send(_toClient, data, length, timeoutMs);
+}
+
+void PsychicMqttLoopback::hangUp()
+{
+    _connected = false;
+}
+
+bool PsychicMqttLoopback::connected()
+{
+    return _connected;
+}
+
+int PsychicMqttLoopback::_receive(StreamBufferHandle_t buffer, uint8_t *data, size_t length, int timeoutMs)
+{
+    // Wait in slices so a closed connection is noticed while blocked
+    int64_t deadline = esp_timer_get_time() + (int64_t)timeoutMs * 1000;
+    while (true)
+    {
+        int64_t remaining = (deadline - esp_timer_get_time()) / 1000;
+        int slice = remaining < PSYCHIC_MQTT_LOOPBACK_SLICE_MS ? (remaining > 0 ? (int)remaining : 0)
+                                                                : PSYCHIC_MQTT_LOOPBACK_SLICE_MS;
+        size_t received = xStreamBufferReceive(buffer, data, length, pdMS_TO_TICKS(slice));
+        if (received > 0)
+            return (int)received;
+        if (!_connected)
+            return -1;
+        if (remaining <= 0)
+            return 0;
+    }
+}
+
+int PsychicMqttLoopback::_send(StreamBufferHandle_t buffer, const uint8_t *data, size_t length, int timeoutMs)
+{
+    int64_t deadline = esp_timer_get_time() + (int64_t)timeoutMs * 1000;
+    size_t sent = 0;
+    while (sent < length)
+    {
+        if (!_connected)
+            return -1;
+        int64_t remaining = (deadline - esp_timer_get_time()) / 1000;
+        int slice = remaining < PSYCHIC_MQTT_LOOPBACK_SLICE_MS ? (remaining > 0 ? (int)remaining : 0)
+                                                                : PSYCHIC_MQTT_LOOPBACK_SLICE_MS;
+        sent += xStreamBufferSend(buffer, data + sent, length - sent, pdMS_TO_TICKS(slice));
+        if (remaining <= 0)
+            break;
+    }
+    return (int)sent;
+}
+
+int PsychicMqttLoopback::_connect(esp_transport_handle_t t, const char *, int, int)
+{
+    PsychicMqttLoopback *loopback = (PsychicMqttLoopback *)esp_transport_get_context_data(t);
+
+    // Drop what the peer sent to the previous connection, the client task is the only reader
+    uint8_t discard[64];
+    while (xStreamBufferReceive(loopback->_toClient, discard, sizeof(discard), 0) > 0)
+    {
+    }
+    loopback->_peeked = false;
+    loopback->_connected = true;
+    loopback->_sessions++;
+    return 0;
+}
+
+int PsychicMqttLoopback::_read(esp_transport_handle_t t, char *buffer, int length, int timeoutMs)
+{
+    PsychicMqttLoopback *loopback = (PsychicMqttLoopback *)esp_transport_get_context_data(t);
+    if (length <= 0)
+        return 0;
+    if (loopback->_peeked)
+    {
+        loopback->_peeked = false;
+        buffer[0] = (char)loopback->_peekedByte;
+        return 1 + (int)xStreamBufferReceive(loopback->_toClient, buffer + 1, length - 1, 0);
+    }
+    return loopback->_receive(loopback->_toClient, (uint8_t *)buffer, length, timeoutMs);
+}
+
+int PsychicMqttLoopback::_write(esp_transport_handle_t t, const char *buffer, int length, int timeoutMs)
+{
+    PsychicMqttLoopback *loopback = (PsychicMqttLoopback *)esp_transport_get_context_data(t);
+    return loopback->_send(loopback->_toPeer, (const uint8_t *)buffer, length, timeoutMs);
+}
+
+int PsychicMqttLoopback::_close(esp_transport_handle_t t)
+{
+    PsychicMqttLoopback *loopback = (PsychicMqttLoopback *)esp_transport_get_context_data(t);
+    loopback->_connected = false;
+    return 0;
+}
+
+int PsychicMqttLoopback::_pollRead(esp_transport_handle_t t, int timeoutMs)
+{
+    // Stream buffers cannot be waited on without reading, so one byte is kept for the next read
+    PsychicMqttLoopback *loopback = (PsychicMqttLoopback *)esp_transport_get_context_data(t);
+    if (loopback->_peeked)
+        return 1;
+    int received = loopback->_receive(loopback->_toClient, &loopback->_peekedByte, 1, timeoutMs);
+    if (received > 0)
+        loopback->_peeked = true;
+    return received;
+}
+
+int PsychicMqttLoopback::_pollWrite(esp_transport_handle_t t, int)
+{
+    PsychicMqttLoopback *loopback = (PsychicMqttLoopback *)esp_transport_get_context_data(t);
+    return loopback->_connected ? 1 : -1;
+}
+
+int PsychicMqttLoopback::_destroy(esp_transport_handle_t t)
+{
+    PsychicMqttLoopback *loopback = (PsychicMqttLoopback *)esp_transport_get_context_data(t);
+    loopback->_transport = nullptr;
+    return 0;
+}
+
+/*------------------------------------------------------------------------------------------------*/
+// File descriptor
+/*------------------------------------------------------------------------------------------------*/
+
+PsychicMqttFdTransport::PsychicMqttFdTransport(int fd) : _fd(fd)
+{
+}
+
+PsychicMqttFdTransport::~PsychicMqttFdTransport()
+{
+    if (_transport != nullptr)
+        esp_transport_destroy(_transport);
+}
+
+esp_transport_handle_t PsychicMqttFdTransport::transport()
+{
+    if (_transport == nullptr)
+    {
+        _transport = esp_transport_init();
+        esp_transport_set_func(_transport, _connect, _read, _write, _close, _pollRead, _pollWrite, _destroy);
+        esp_transport_set_context_data(_transport, this);
+    }
+    return _transport;
+}
+
+int PsychicMqttFdTransport::_wait(int fd, bool write, int timeoutMs)
+{
+    fd_set set;
+    FD_ZERO(&set);
+    FD_SET(fd, &set);
+    struct timeval timeout = {timeoutMs / 1000, (timeoutMs % 1000) * 1000};
+    int ready = select(fd + 1, write ? nullptr : &set, write ? &set : nullptr, nullptr, &timeout);
+    if (ready < 0 && errno == EINTR)
+        return 0;
+    return ready;
+}
+
+int PsychicMqttFdTransport::_connect(esp_transport_handle_t t, const char *, int, int)
+{
+    PsychicMqttFdTransport *transport = (PsychicMqttFdTransport *)esp_transport_get_context_data(t);
+    return transport->_fd >= 0 ? 0 : -1;
+}
+
+int PsychicMqttFdTransport::_read(esp_transport_handle_t t, char *buffer, int length, int timeoutMs)
+{
+    PsychicMqttFdTransport *transport = (PsychicMqttFdTransport *)esp_transport_get_context_data(t);
+    int ready = _wait(transport->_fd, false, timeoutMs);
+    if (ready <= 0)
+        return ready;
+    int received = ::read(transport->_fd, buffer, length);
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return 0;
+    // End of file, the other side closed the stream
+    if (received == 0)
+        return -1;
+    return received;
+}
+
+int PsychicMqttFdTransport::_write(esp_transport_handle_t t, const char *buffer, int length, int timeoutMs)
+{
+    PsychicMqttFdTransport *transport = (PsychicMqttFdTransport *)esp_transport_get_context_data(t);
+    int64_t deadline = esp_timer_get_time() + (int64_t)timeoutMs * 1000;
+    int sent = 0;
+    while (sent < length)
+    {
+        int remaining = (int)((deadline - esp_timer_get_time()) / 1000);
+        int ready = _wait(transport->_fd, true, remaining > 0 ? remaining : 0);
+        if (ready < 0)
+            return -1;
+        if (ready == 0)
+            break;
+        int written = ::write(transport->_fd, buffer + sent, length - sent);
+        if (written < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            return -1;
+        if (written > 0)
+            sent += written;
+    }
+    return sent;
+}
+
+int PsychicMqttFdTransport::_close(esp_transport_handle_t)
+{
+    // The descriptor belongs to the application
+    return 0;
+}
+
+int PsychicMqttFdTransport::_pollRead(esp_transport_handle_t t, int timeoutMs)
+{
+    PsychicMqttFdTransport *transport = (PsychicMqttFdTransport *)esp_transport_get_context_data(t);
+    return _wait(transport->_fd, false, timeoutMs);
+}
+
+int PsychicMqttFdTransport::_pollWrite(esp_transport_handle_t t, int timeoutMs)
+{
+    PsychicMqttFdTransport *transport = (PsychicMqttFdTransport *)esp_transport_get_context_data(t);
+    return _wait(transport->_fd, true, timeoutMs);
+}
+
+int PsychicMqttFdTransport::_destroy(esp_transport_handle_t t)
+{
+    PsychicMqttFdTransport *transport = (PsychicMqttFdTransport *)esp_transport_get_context_data(t);
+    transport->_transport = nullptr;
+    return 0;
+}
@@ -0,0 +1,147 @@
+#pragma once
+/**
+ *   PsychicMqttClient
+ *
+ *   Reference transports for PsychicMqttClient::setTransport(). The ESP-IDF MQTT
+ *   client talks to the network through an esp_transport_handle_t, a set of
+ *   connect, read, write, poll and close functions. Any byte stream can carry
+ *   MQTT this way, without a TCP/IP stack in between.
+ *
+ *   PsychicMqttLoopback connects the client to a peer in the same process
+ *   through two FreeRTOS stream buffers. The peer is typically a broker
+ *   emulation, which takes the network out of a benchmark.
+ *
+ *   PsychicMqttFdTransport runs over an open file descriptor, e.g. one end of a
+ *   POSIX socket pair on the host or a UART opened through the ESP-IDF VFS.
+ *
+ *   esp-mqtt destroys a custom transport together with the client, so the handle
+ *   is owned by the client once it was passed to setTransport(). The transport
+ *   objects must outlive the client.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "esp_transport.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/stream_buffer.h"
+
+#define PSYCHIC_MQTT_LOOPBACK_BUFFER_SIZE 4096
+#define PSYCHIC_MQTT_LOOPBACK_SLICE_MS 10 // a closed connection is noticed within this time
+
+class PsychicMqttLoopback
+{
+public:
+    /**
+     * @brief Creates an in-memory connection between the client and a peer.
+     *
+     * @param bufferSize Size of each of the two stream buffers in bytes.
+     */
+    explicit PsychicMqttLoopback(size_t bufferSize = PSYCHIC_MQTT_LOOPBACK_BUFFER_SIZE);
+    ~PsychicMqttLoopback();
+
+    /**
+     * @brief Returns the client end of the connection for setTransport(). Host and
+     * port of the URI are ignored.
+     *
+     * @return The transport handle, created on first use.
+     */
+    esp_transport_handle_t transport();
+
+    /**
+     * @brief Waits for the client to open a new connection. Call again after read()
+     * or write() returned -1 to serve the next connection.
+     *
+     * @param timeoutMs Maximum time to wait in milliseconds.
+     * @return true if a connection was opened.
+     */
+    bool accept(int timeoutMs);
+
+    /**
+     * @brief Reads what the client sent.
+     *
+     * @param buffer Destination buffer.
+     * @param length Size of the destination buffer.
+     * @param timeoutMs Maximum time to wait for data in milliseconds.
+     * @return The number of bytes read, 0 on timeout or -1 if the connection was closed.
+     */
+    int read(uint8_t *buffer, size_t length, int timeoutMs);
+
+    /**
+     * @brief Sends data to the client. Blocks while the stream buffer is full.
+     *
+     * @param data The data to send.
+     * @param length Length of the data.
+     * @param timeoutMs Maximum time to wait for space in milliseconds.
+     * @return The number of bytes written or -1 if the connection was closed.
+     */
+    int write(const uint8_t *data, size_t length, int timeoutMs);
+
+    /**
+     * @brief Closes the connection from the peer side. The client sees a transport error.
+     */
+    void hangUp();
+
+    /**
+     * @brief Returns whether the client is connected.
+     */
+    bool connected();
+
+private:
+    StreamBufferHandle_t _toClient;
+    StreamBufferHandle_t _toPeer;
+    esp_transport_handle_t _transport = nullptr;
+    std::atomic<bool> _connected{false};
+    std::atomic<uint32_t> _sessions{0};
+    uint32_t _accepted = 0;
+    bool _peeked = false; // poll_read received one byte ahead of read
+    uint8_t _peekedByte = 0;
+
+    int _receive(StreamBufferHandle_t buffer, uint8_t *data, size_t length, int timeoutMs);
+    int _send(StreamBufferHandle_t buffer, const uint8_t *data, size_t length, int timeoutMs);
+
+    static int _connect(esp_transport_handle_t t, const char *host, int port, int timeoutMs);
+    static int _read(esp_transport_handle_t t, char *buffer, int length, int timeoutMs);
+    static int _write(esp_transport_handle_t t, const char *buffer, int length, int timeoutMs);
+    static int _close(esp_transport_handle_t t);
+    static int _pollRead(esp_transport_handle_t t, int timeoutMs);
+    static int _pollWrite(esp_transport_handle_t t, int timeoutMs);
+    static int _destroy(esp_transport_handle_t t);
+};
+
+class PsychicMqttFdTransport
+{
+public:
+    /**
+     * @brief Creates a transport over an open file descriptor that supports select().
+     * The descriptor is not closed by the transport, a reconnect continues on the
+     * same byte stream.
+     *
+     * @param fd The file descriptor, e.g. one end of socketpair().
+     */
+    explicit PsychicMqttFdTransport(int fd);
+    ~PsychicMqttFdTransport();
+
+    /**
+     * @brief Returns the transport handle for setTransport(). Host and port of the
+     * URI are ignored.
+     *
+     * @return The transport handle, created on first use.
+     */
+    esp_transport_handle_t transport();
+
+private:
+    int _fd;
+    esp_transport_handle_t _transport = nullptr;
+
+    static int _wait(int fd, bool write, int timeoutMs);
+
+    static int _connect(esp_transport_handle_t t, const char *host, int port, int timeoutMs);
+    static int _read(esp_transport_handle_t t, char *buffer, int length, int timeoutMs);
+    static int _write(esp_transport_handle_t t, const char *buffer, int length, int timeoutMs);
+    static int _close(esp_transport_handle_t t);
+    static int _pollRead(esp_transport_handle_t t, int timeoutMs);
+    static int _pollWrite(esp_transport_handle_t t, int timeoutMs);
+    static int _destroy(esp_transport_handle_t t);
+};